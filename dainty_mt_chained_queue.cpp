@@ -24,9 +24,13 @@
 
 ******************************************************************************/
 
+#include <new>
+#include <atomic>
+#include <type_traits>
 #include "dainty_os_fdbased.h"
 #include "dainty_os_threading.h"
 #include "dainty_mt_chained_queue.h"
+#include "dainty_mt_internal_.h"
 
 namespace dainty
 {
@@ -38,8 +42,230 @@ namespace chained_queue
   using named::t_n_;
   using namespace os::threading;
   using namespace os::fdbased;
+  using named::t_uint64;
+  using named::t_int64;
+  using internal_::CACHE_LINE;
+  using internal_::t_pad_;
+  using internal_::spin_wait_;
   using t_queue = container::chained_queue::t_chained_queue<t_any>;
 
+///////////////////////////////////////////////////////////////////////////////
+
+  namespace
+  {
+    t_uint64 ring_size_(t_n max) noexcept {
+      t_uint64 size = 1;
+      while (size < get(max))
+        size <<= 1;
+      return size;
+    }
+
+    // cache line aligned array with either a packed or a padded stride.
+    template<typename T>
+    class t_slots_ {
+    public:
+      t_slots_(t_uint64 n, t_layout layout) noexcept
+        : n_{n}, stride_{layout == PADDED_LAYOUT ?
+                           (sizeof(T) + CACHE_LINE - 1) / CACHE_LINE *
+                             CACHE_LINE : sizeof(T)},
+          mem_{new (std::nothrow) char[n_*stride_ + CACHE_LINE]} {
+        if (mem_) {
+          const t_uint64 addr = reinterpret_cast<t_uint64>(mem_);
+          base_ = mem_ + (CACHE_LINE - addr % CACHE_LINE) % CACHE_LINE;
+          for (t_uint64 ix = 0; ix < n_; ++ix)
+            new (base_ + ix*stride_) T();
+        }
+      }
+
+      ~t_slots_() {
+        if (mem_) {
+          for (t_uint64 ix = 0; ix < n_; ++ix)
+            (*this)[ix].~T();
+          delete [] mem_;
+        }
+      }
+
+      t_slots_(const t_slots_&)            = delete;
+      t_slots_& operator=(const t_slots_&) = delete;
+
+      operator t_validity() const noexcept {
+        return mem_ ? VALID : INVALID;
+      }
+
+      T& operator[](t_uint64 ix) noexcept {
+        return *reinterpret_cast<T*>(base_ + ix*stride_);
+      }
+
+    private:
+      const t_uint64 n_;
+      const t_uint64 stride_;
+      char*          mem_;
+      char*          base_ = nullptr;
+    };
+
+    using t_item_  = std::remove_pointer_t<decltype(t_queue::t_chain::head)>;
+    using t_items_ = t_slots_<t_item_>;
+
+    // LOCKFREE_MODE keeps its single slot items in an array of its own,
+    // where the layout decides the stride. they never go to the container.
+    static_assert(std::is_default_constructible<t_item_>::value,
+                  "container items must be constructible outside of it");
+
+    // hand every item to free as a single item chain.
+    template<typename R>
+    t_void fill_(t_items_& items, R& free, t_n max) noexcept {
+      for (t_n_ ix = 0; ix < get(max); ++ix) {
+        t_queue::t_chain chain;
+        chain.cnt  = t_n{1};
+        chain.head = chain.tail = &items[ix];
+        free.push(chain);
+      }
+    }
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // bounded multi-producer/multi-consumer ring of chains (sequence numbered
+  // cells). used by LOCKFREE_MODE for both the free list and the ready list.
+  class t_ring_ {
+  public:
+    using t_chain = t_queue::t_chain;
+
+    t_ring_(t_n max, t_layout layout) noexcept
+      : mask_{ring_size_(max) - 1}, cells_{mask_ + 1, layout} {
+      if (cells_ == VALID)
+        for (t_uint64 ix = 0; ix <= mask_; ++ix)
+          cells_[ix].seq.store(ix, std::memory_order_relaxed);
+    }
+
+    operator t_validity() const noexcept {
+      return cells_;
+    }
+
+    t_bool push(const t_chain& chain) noexcept {
+      t_uint64 pos = tail_.load(std::memory_order_relaxed);
+      for (;;) {
+        t_cell_& cell = cells_[pos & mask_];
+        t_uint64 seq  = cell.seq.load(std::memory_order_acquire);
+        t_int64  diff = static_cast<t_int64>(seq - pos);
+        if (!diff) {
+          if (tail_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+            cell.chain = chain;
+            cell.seq.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0)
+          return false;
+        else
+          pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    t_bool pop(t_chain& chain) noexcept {
+      t_uint64 pos = head_.load(std::memory_order_relaxed);
+      for (;;) {
+        t_cell_& cell = cells_[pos & mask_];
+        t_uint64 seq  = cell.seq.load(std::memory_order_acquire);
+        t_int64  diff = static_cast<t_int64>(seq - (pos + 1));
+        if (!diff) {
+          if (head_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+            chain = cell.chain;
+            cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0)
+          return false;
+        else
+          pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+
+  private:
+    struct t_cell_ {
+      std::atomic<t_uint64> seq{0};
+      t_chain               chain;
+    };
+
+    const t_uint64        mask_;
+    t_slots_<t_cell_>     cells_;
+    t_pad_                pad1_;
+    std::atomic<t_uint64> head_{0};
+    t_pad_                pad2_;
+    std::atomic<t_uint64> tail_{0};
+    t_pad_                pad3_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // wait-free single producer/single consumer ring of chains.
+  class t_lane_ring_ {
+  public:
+    using t_chain = t_queue::t_chain;
+
+    t_lane_ring_(t_n max, t_layout layout) noexcept
+      : mask_{ring_size_(max) - 1}, chains_{mask_ + 1, layout} {
+    }
+
+    operator t_validity() const noexcept {
+      return chains_;
+    }
+
+    t_bool push(const t_chain& chain) noexcept {
+      t_uint64 tail = tail_.load(std::memory_order_relaxed);
+      if (tail - head_.load(std::memory_order_acquire) > mask_)
+        return false;
+      chains_[tail & mask_] = chain;
+      tail_.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    t_bool pop(t_chain& chain) noexcept {
+      t_uint64 head = head_.load(std::memory_order_relaxed);
+      if (head == tail_.load(std::memory_order_acquire))
+        return false;
+      chain = chains_[head & mask_];
+      head_.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    const t_uint64        mask_;
+    t_slots_<t_chain>     chains_;
+    t_pad_                pad1_;
+    std::atomic<t_uint64> head_{0};
+    t_pad_                pad2_;
+    std::atomic<t_uint64> tail_{0};
+    t_pad_                pad3_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // a lane belongs to one producer thread. free is filled by the consumer
+  // and emptied by the producer, ready the other way around.
+  class t_lane_ {
+  public:
+    using t_chain = t_queue::t_chain;
+
+    t_lane_(t_n max, t_layout layout) noexcept
+      : items{get(max), layout}, free{max, layout}, ready{max, layout} {
+      if (items == VALID && free == VALID && ready == VALID) {
+        fill_(items, free, max);
+        valid = VALID;
+      }
+    }
+
+    t_validity           valid = INVALID;
+    t_items_             items;
+    t_lane_ring_         free;
+    t_lane_ring_         ready;
+    std::atomic<t_int64> pending{0};
+    t_pad_               pad;
+  };
+  using p_lane_ = t_prefix<t_lane_>::p_;
+  using r_lane_ = t_prefix<t_lane_>::r_;
+
 ///////////////////////////////////////////////////////////////////////////////
 
   class t_impl_ {
@@ -47,11 +273,34 @@ namespace chained_queue
     using t_chain = t_queue::t_chain;
     using r_logic = t_processor::r_logic;
 
-    t_impl_(r_err err, t_n max) noexcept
-      : queue_{err, max}, eventfd_(err, t_n{0}), lock1_{err}, lock2_{err} {
-      if (queue_ == VALID && eventfd_ == VALID && lock1_ == VALID &&
-          lock2_ == VALID)
-        valid_ = VALID;
+    t_impl_(r_err err, R_params params) noexcept
+      : mode_{params.mode}, signal_{params.signal}, spin_{params.spin},
+        layout_{params.layout},
+        max_lanes_{params.mode == LOCKFREE_MODE ? get(params.max_lanes) : 0},
+        lanes_{new p_lane_[max_lanes_ + 1]},
+        queue_{err, params.max},
+        items_{params.mode == LOCKFREE_MODE ? get(params.max) : 0, layout_},
+        eventfd_(err, t_n{0}), lock1_{err}, lock2_{err},
+        free_ {params.mode == LOCKFREE_MODE ? params.max : t_n{1}, layout_},
+        ready_{params.mode == LOCKFREE_MODE ? params.max : t_n{1}, layout_} {
+      batch_.reserve(get(params.max));
+      batch_lanes_.reserve(get(params.max));
+      if (queue_ == VALID && items_ == VALID && eventfd_ == VALID &&
+          lock1_ == VALID && lock2_ == VALID && free_ == VALID &&
+          ready_ == VALID && lanes_) {
+        if (mode_ == LOCKFREE_MODE)
+          fill_(items_, free_, params.max);
+        else if (layout_ == PADDED_LAYOUT)
+          err = err::E_XXX; // the container slots cannot be padded
+        if (!err)
+          valid_ = VALID;
+      }
+    }
+
+    ~t_impl_() {
+      for (t_n_ ix = 0, n = lanes_cnt_.load(); ix < n; ++ix)
+        delete lanes_[ix];
+      delete [] lanes_;
     }
 
     operator t_validity() const noexcept {
@@ -59,6 +308,11 @@ namespace chained_queue
     }
 
     t_void process(r_err err, r_logic logic, t_n max) noexcept {
+      if (mode_ == LOCKFREE_MODE)
+        return lockfree_process_(err, logic, max);
+      if (signal_ == ARMED_SIGNAL)
+        return armed_process_(err, logic, max);
+
       for (t_n_ n = get(max); !err && n; --n) {
         t_eventfd::t_value value = 0;
         eventfd_.read(err, value);
@@ -70,14 +324,17 @@ namespace chained_queue
 
         if (get(chain.cnt)) {
           logic.async_process(chain);
-          <% auto scope = lock1_.make_locked_scope(err);
-            queue_.release(err, chain);
-          %>
+          release_(err, chain);
         }
       }
     }
 
     t_void process_available(r_err err, r_logic logic) noexcept { //XXX - must read fd
+      if (mode_ == LOCKFREE_MODE)
+        return lockfree_process_available_(err, logic);
+      if (signal_ == ARMED_SIGNAL)
+        return armed_process_available_(err, logic);
+
       t_chain chain;
       <% auto scope = lock2_.make_locked_scope(err);
         chain = queue_.remove(err);
@@ -88,13 +345,70 @@ namespace chained_queue
       %>
       if (get(chain.cnt)) {
         logic.async_process(chain);
-        <% auto scope = lock1_.make_locked_scope(err);
-          queue_.release(err, chain);
+        release_(err, chain);
+      }
+    }
+
+    t_n drain(r_err err, r_logic logic, t_n max_items) noexcept {
+      const t_n_ max = get(max_items) < batch_.capacity() ? get(max_items)
+                                                          : batch_.capacity();
+      if (mode_ == LOCKFREE_MODE) {
+        t_chain chain;
+        p_lane_ lane = nullptr;
+        while (!err && batch_.size() < max &&
+               lockfree_remove_(err, chain, lane)) {
+          batch_.push_back(chain);
+          batch_lanes_.push_back(lane);
+        }
+        if (!batch_.empty()) {
+          logic.async_process_batch(batch_);
+          for (t_n_ ix = 0; ix < batch_.size(); ++ix)
+            lockfree_release_(batch_lanes_[ix], batch_[ix]);
+        }
+      } else {
+        // the container hands out its ready list as a whole, as one chain.
+        t_bool rearmed = false;
+        <% auto scope = lock2_.make_locked_scope(err);
+          t_chain chain = queue_.remove(err);
+          if (!err && get(chain.cnt))
+            batch_.push_back(chain);
+          if (!err && signal_ == ARMED_SIGNAL && !armed_ &&
+              queue_.is_empty())
+            rearmed = armed_ = true;
         %>
+
+        if (signal_ == ARMED_SIGNAL) {
+          if (rearmed && !named::utility::reset(woken_))
+            armed_read_(err);
+        } else if (!batch_.empty()) {
+          t_eventfd::t_value value = 0;
+          eventfd_.read(err, value);
+        }
+
+        if (!batch_.empty()) {
+          logic.async_process_batch(batch_);
+          <% auto scope = lock1_.make_locked_scope(err);
+            for (auto& chain : batch_)
+              queue_.release(err, chain);
+            wake_locked_();
+          %>
+        }
       }
+      const t_n n{batch_.size()};
+      batch_.clear();
+      batch_lanes_.clear();
+      return n;
     }
 
     t_chain acquire(t_user, t_n n) noexcept {
+      if (mode_ == LOCKFREE_MODE) {
+        t_chain chain;
+        if (get(n) != 1)
+          return bulk_acquire_(n);
+        free_.pop(chain);
+        return chain;
+      }
+
       <% auto scope = lock1_.make_locked_scope();
         if (scope == VALID)
           return queue_.acquire(n);
@@ -103,6 +417,15 @@ namespace chained_queue
     }
 
     t_chain acquire(r_err err, t_user, t_n n) noexcept {
+      if (mode_ == LOCKFREE_MODE) {
+        t_chain chain;
+        if (get(n) != 1)
+          return bulk_acquire_(err, n);
+        if (!free_.pop(chain))
+          err = err::E_XXX;
+        return chain;
+      }
+
       <% auto scope = lock1_.make_locked_scope(err);
         return queue_.acquire(err, n);
       %>
@@ -110,13 +433,20 @@ namespace chained_queue
     }
 
     t_errn insert(t_user, t_chain& chain) noexcept {
+      if (mode_ == LOCKFREE_MODE)
+        return lockfree_insert_(chain);
+
       t_errn errn{-1};
       if (get(chain.cnt)) {
         t_bool send = false;
         <% auto scope = lock2_.make_locked_scope();
           if (scope == VALID) {
-            send = queue_.is_empty();
+            send = signal_ == ARMED_SIGNAL ? named::utility::reset(armed_)
+                                           : queue_.is_empty();
             queue_.insert(chain);
+            inserted_.fetch_add(1, std::memory_order_release);
+            if (!send)
+              set(errn) = 0;
           }
         %>
         if (send) {
@@ -128,11 +458,20 @@ namespace chained_queue
     }
 
     t_void insert(r_err err, t_user, t_chain& chain) noexcept {
+      if (mode_ == LOCKFREE_MODE) {
+        if (lockfree_insert_(chain) != VALID)
+          err = err::E_XXX;
+        return;
+      }
+
       if (get(chain.cnt)) {
         t_bool send = false;
         <% auto scope = lock2_.make_locked_scope(err);
-          send = queue_.is_empty();
+          send = signal_ == ARMED_SIGNAL ? named::utility::reset(armed_)
+                                         : queue_.is_empty();
           queue_.insert(err, chain);
+          if (!err)
+            inserted_.fetch_add(1, std::memory_order_release);
         %>
         if (send) {
           t_eventfd::t_value value = 1;
@@ -142,6 +481,37 @@ namespace chained_queue
         err = err::E_XXX;
     }
 
+    t_chain acquire(r_lane_ lane, t_n n) noexcept {
+      t_chain chain;
+      if (get(n) != 1)
+        return bulk_acquire_(n);
+      lane.free.pop(chain);
+      return chain;
+    }
+
+    t_chain acquire(r_err err, r_lane_ lane, t_n n) noexcept {
+      t_chain chain;
+      if (get(n) != 1)
+        return bulk_acquire_(err, n);
+      if (!lane.free.pop(chain))
+        err = err::E_XXX;
+      return chain;
+    }
+
+    t_errn insert(r_lane_ lane, t_chain& chain) noexcept {
+      if (get(chain.cnt) > 1)
+        return bulk_insert_(chain);
+      t_errn errn{-1};
+      if (get(chain.cnt) == 1 && lane.ready.push(chain))
+        errn = lockfree_signal_(lane.pending);
+      return errn;
+    }
+
+    t_void insert(r_err err, r_lane_ lane, t_chain& chain) noexcept {
+      if (insert(lane, chain) != VALID)
+        err = err::E_XXX;
+    }
+
     t_fd get_fd() const noexcept {
       return eventfd_.get_fd();
     }
@@ -156,12 +526,368 @@ namespace chained_queue
       return {this, user};
     }
 
+    t_client make_lane_client(r_err err, t_user user, t_n max) noexcept {
+      p_lane_ lane = nullptr;
+      <% auto scope = lock1_.make_locked_scope(err);
+        t_n_ ix = lanes_cnt_.load(std::memory_order_relaxed);
+        if (!err && ix < max_lanes_) {
+          lane = new t_lane_(max, layout_);
+          if (lane->valid == VALID) {
+            lanes_[ix] = lane;
+            lanes_cnt_.store(ix + 1, std::memory_order_release);
+          } else {
+            delete lane;
+            lane = nullptr;
+            if (!err)
+              err = err::E_XXX;
+          }
+        } else if (!err)
+          err = err::E_XXX;
+      %>
+      if (lane)
+        return {this, lane, user};
+      return {};
+    }
+
+    // a wakeup is linked under lock1_ and counted in wakeups_. a producer
+    // counts it before it retries to acquire and a release checks the count
+    // after it freed its slots, both behind a fence, so either the retry
+    // finds the slots or the release finds the wakeup.
+    t_void enqueue(r_err err, r_wakeup wakeup) noexcept {
+      <% auto scope = lock1_.make_locked_scope(err);
+        if (!wakeup.queued_) {
+          wakeup.prev_ = wakeups_tail_;
+          if (wakeups_tail_)
+            wakeups_tail_->next_ = &wakeup;
+          else
+            wakeups_head_ = &wakeup;
+          wakeups_tail_  = &wakeup;
+          wakeup.queued_ = true;
+          wakeups_.fetch_add(1, std::memory_order_relaxed);
+        }
+      %>
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    t_void cancel(r_wakeup wakeup) noexcept {
+      <% auto scope = lock1_.make_locked_scope();
+        if (scope == VALID && wakeup.queued_)
+          dequeue_(wakeup);
+      %>
+    }
+
   private:
-    t_validity   valid_ = INVALID;
-    t_queue      queue_;
-    t_eventfd    eventfd_;
-    t_mutex_lock lock1_;
-    t_mutex_lock lock2_;
+    t_void dequeue_(r_wakeup wakeup) noexcept {
+      if (wakeup.prev_)
+        wakeup.prev_->next_ = wakeup.next_;
+      else
+        wakeups_head_ = wakeup.next_;
+      if (wakeup.next_)
+        wakeup.next_->prev_ = wakeup.prev_;
+      else
+        wakeups_tail_ = wakeup.prev_;
+      wakeup.prev_   = wakeup.next_ = nullptr;
+      wakeup.queued_ = false;
+      wakeups_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // every queued wakeup is woken, whatever it waits for. a slot of the
+    // shared ring is of no use to a lane and a single slot of no use to a
+    // wakeup that waits for more.
+    t_void wake_locked_() noexcept {
+      while (wakeups_head_) {
+        r_wakeup wakeup = *wakeups_head_;
+        dequeue_(wakeup);
+        wakeup.wake();
+      }
+    }
+
+    t_void wake_() noexcept {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (wakeups_.load(std::memory_order_relaxed)) {
+        <% auto scope = lock1_.make_locked_scope();
+          if (scope == VALID)
+            wake_locked_();
+        %>
+      }
+    }
+
+    t_void release_(r_err err, t_chain& chain) noexcept {
+      <% auto scope = lock1_.make_locked_scope(err);
+        queue_.release(err, chain);
+        wake_locked_();
+      %>
+    }
+
+    // armed_ is only touched under lock2_. a producer that finds it set,
+    // clears it and writes the eventfd once. the consumer re-arms when it
+    // finds the queue empty and reads back that single write, unless it
+    // already did so while it was blocked.
+    t_void armed_read_(r_err err) noexcept {
+      t_eventfd::t_value value = 0;
+      eventfd_.read(err, value);
+    }
+
+    t_void armed_process_(r_err err, r_logic logic, t_n max) noexcept {
+      t_bool spun = false;
+      for (t_n_ n = get(max); !err && n; ) {
+        t_chain  chain;
+        t_bool   rearmed = false, sleep = false;
+        t_uint64 seen = 0;
+        <% auto scope = lock2_.make_locked_scope(err);
+          chain = queue_.remove(err);
+          if (!err && !get(chain.cnt)) {
+            seen = inserted_.load(std::memory_order_relaxed);
+            if (!spun && get(spin_))
+              ; // poll once before arming or sleeping
+            else if (armed_)
+              sleep = true;
+            else
+              rearmed = armed_ = true;
+          }
+        %>
+
+        if (get(chain.cnt)) {
+          spun = false;
+          logic.async_process(chain);
+          release_(err, chain);
+          --n;
+        } else if (!err && !spun && get(spin_)) {
+          spun = true;
+          spin_wait_(get(spin_), [this, seen]() {
+            return inserted_.load(std::memory_order_acquire) != seen; });
+        } else if (sleep) {
+          armed_read_(err);
+          woken_ = true;
+        } else if (rearmed && !named::utility::reset(woken_))
+          armed_read_(err);
+      }
+    }
+
+    t_void armed_process_available_(r_err err, r_logic logic) noexcept {
+      t_chain chain;
+      t_bool  rearmed = false;
+      <% auto scope = lock2_.make_locked_scope(err);
+        chain = queue_.remove(err);
+        if (!err && !get(chain.cnt) && !armed_)
+          rearmed = armed_ = true;
+      %>
+
+      if (get(chain.cnt)) {
+        logic.async_process(chain);
+        release_(err, chain);
+      } else if (rearmed && !named::utility::reset(woken_))
+        armed_read_(err);
+    }
+
+    // producers signal the eventfd when a pending count goes from 0 to 1 and
+    // the consumer reads it back when it takes that count from 1 to 0,
+    // unless a blocking wait already consumed that write.
+    t_errn lockfree_signal_(std::atomic<t_int64>& pending) noexcept {
+      if (!pending.fetch_add(1, std::memory_order_acq_rel)) {
+        t_eventfd::t_value value = 1;
+        return eventfd_.write(value);
+      }
+      return t_errn{0};
+    }
+
+    t_errn lockfree_insert_(t_chain& chain) noexcept {
+      if (get(chain.cnt) > 1)
+        return bulk_insert_(chain);
+      t_errn errn{-1};
+      if (get(chain.cnt) == 1 && ready_.push(chain))
+        errn = lockfree_signal_(pending_);
+      return errn;
+    }
+
+    // chains of more than one slot come from the container, that is used
+    // as in MUTEX_MODE. lock1_ guards its free list and lock2_ its ready
+    // list and bulk_pending_, which counts the chains inserted since the
+    // consumer last took them all.
+    t_chain bulk_acquire_(t_n n) noexcept {
+      <% auto scope = lock1_.make_locked_scope();
+        if (scope == VALID)
+          return queue_.acquire(n);
+      %>
+      return {};
+    }
+
+    t_chain bulk_acquire_(r_err err, t_n n) noexcept {
+      <% auto scope = lock1_.make_locked_scope(err);
+        return queue_.acquire(err, n);
+      %>
+      return {};
+    }
+
+    t_errn bulk_insert_(t_chain& chain) noexcept {
+      t_errn errn{-1};
+      t_bool send = false;
+      <% auto scope = lock2_.make_locked_scope();
+        if (scope == VALID) {
+          queue_.insert(chain);
+          send = !bulk_pending_.fetch_add(1, std::memory_order_acq_rel);
+          if (!send)
+            set(errn) = 0;
+        }
+      %>
+      if (send) {
+        t_eventfd::t_value value = 1;
+        errn = eventfd_.write(value);
+      }
+      return errn;
+    }
+
+    t_bool bulk_remove_(r_err err, t_chain& chain) noexcept {
+      if (!bulk_pending_.load(std::memory_order_acquire))
+        return false;
+      t_bool removed = false;
+      <% auto scope = lock2_.make_locked_scope(err);
+        chain = queue_.remove(err);
+        if (!err && get(chain.cnt)) {
+          bulk_pending_.store(0, std::memory_order_release);
+          removed = true;
+        }
+      %>
+      if (removed && ++owed_ > consumed_)
+        lockfree_read_(err);
+      return removed;
+    }
+
+    t_void bulk_release_(t_chain& chain) noexcept {
+      <% auto scope = lock1_.make_locked_scope();
+        if (scope == VALID) {
+          queue_.release(chain);
+          wake_locked_();
+        }
+      %>
+    }
+
+    t_void lockfree_read_(r_err err) noexcept {
+      t_eventfd::t_value value = 0;
+      eventfd_.read(err, value);
+      if (!err)
+        consumed_ += value;
+    }
+
+    t_void lockfree_removed_(r_err err,
+                             std::atomic<t_int64>& pending) noexcept {
+      if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+          ++owed_ > consumed_)
+        lockfree_read_(err);
+    }
+
+    t_bool lockfree_idle_() const noexcept {
+      if (pending_.load(std::memory_order_acquire) > 0 ||
+          bulk_pending_.load(std::memory_order_acquire) > 0)
+        return false;
+      for (t_n_ ix = 0, n = lanes_cnt_.load(std::memory_order_acquire);
+           ix < n; ++ix)
+        if (lanes_[ix]->pending.load(std::memory_order_acquire) > 0)
+          return false;
+      return true;
+    }
+
+    // the shared ring and every lane take turns, one chain at a time. the
+    // turn of the shared ring also takes every multi slot chain.
+    t_bool lockfree_remove_(r_err err, t_chain& chain,
+                            p_lane_& lane) noexcept {
+      const t_n_ sources = lanes_cnt_.load(std::memory_order_acquire) + 1;
+      for (t_n_ n = sources; n; --n) {
+        const t_n_ ix = next_++ % sources;
+        if (!ix) {
+          if (ready_.pop(chain)) {
+            lane = nullptr;
+            lockfree_removed_(err, pending_);
+            return true;
+          }
+          if (bulk_remove_(err, chain)) {
+            lane = nullptr;
+            return true;
+          }
+        } else if (lanes_[ix - 1]->ready.pop(chain)) {
+          lane = lanes_[ix - 1];
+          lockfree_removed_(err, lane->pending);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    t_void lockfree_release_(p_lane_ lane, t_chain& chain) noexcept {
+      if (get(chain.cnt) > 1)
+        bulk_release_(chain);
+      else {
+        if (lane)
+          lane->free.push(chain);
+        else
+          free_.push(chain);
+        wake_();
+      }
+    }
+
+    t_void lockfree_process_(r_err err, r_logic logic, t_n max) noexcept {
+      for (t_n_ n = get(max); !err && n; --n) {
+        t_chain chain;
+        p_lane_ lane = nullptr;
+        while (!err && !lockfree_remove_(err, chain, lane)) {
+          // a producer that claimed a cell but did not publish it yet,
+          // holds up the ring for a moment. only block when nothing is due.
+          if (lockfree_idle_() &&
+              !spin_wait_(get(spin_), [this]() { return !lockfree_idle_(); }))
+            lockfree_read_(err);
+        }
+        if (!err) {
+          logic.async_process(chain);
+          lockfree_release_(lane, chain);
+        }
+      }
+    }
+
+    t_void lockfree_process_available_(r_err err, r_logic logic) noexcept {
+      t_chain chain;
+      p_lane_ lane = nullptr;
+      if (lockfree_remove_(err, chain, lane)) {
+        logic.async_process(chain);
+        lockfree_release_(lane, chain);
+      }
+    }
+
+    // read-only after construction.
+    const t_mode          mode_;
+    const t_signal        signal_;
+    const t_spin          spin_;
+    const t_layout        layout_;
+    const t_n_            max_lanes_;
+    p_lane_*              lanes_;
+    t_validity            valid_ = INVALID;
+    t_queue               queue_;
+    t_items_              items_;
+    t_eventfd             eventfd_;
+    t_pad_                pad1_;
+    // free list side.
+    t_mutex_lock          lock1_;
+    p_wakeup              wakeups_head_ = nullptr;
+    p_wakeup              wakeups_tail_ = nullptr;
+    std::atomic<t_n_>     wakeups_{0};
+    t_pad_                pad2_;
+    // ready list side, written by every producer.
+    t_mutex_lock          lock2_;
+    t_bool                armed_ = true;
+    std::atomic<t_uint64> inserted_{0};
+    t_pad_                pad3_;
+    std::atomic<t_int64>  pending_{0};
+    std::atomic<t_int64>  bulk_pending_{0};
+    t_pad_                pad4_;
+    t_ring_               free_;
+    t_ring_               ready_;
+    // consumer only.
+    t_bool                woken_    = false;
+    t_uint64              owed_     = 0;
+    t_uint64              consumed_ = 0;
+    t_n_                  next_     = 0;
+    std::atomic<t_n_>     lanes_cnt_{0};
+    t_chains              batch_;
+    std::vector<p_lane_>  batch_lanes_;
   };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -170,8 +896,13 @@ namespace chained_queue
     : impl_(impl), user_(user) {
   }
 
+  t_client::t_client(t_impl_user_ impl, t_lane_user_ lane,
+                     t_user user) noexcept
+    : impl_(impl), lane_(lane), user_(user) {
+  }
+
   t_client::t_client(x_client client) noexcept
-    : impl_{client.impl_.release()},
+    : impl_{client.impl_.release()}, lane_{client.lane_.release()},
       user_{named::utility::reset(client.user_)} {
   }
 
@@ -180,40 +911,88 @@ namespace chained_queue
   }
 
   t_client::t_chain t_client::acquire(t_n cnt) noexcept {
-    if (*this == VALID)
+    if (*this == VALID) {
+      if (lane_ == VALID)
+        return impl_->acquire(*lane_, cnt);
       return impl_->acquire(user_, cnt);
+    }
     return {};
   }
 
   t_client::t_chain t_client::acquire(t_err err, t_n cnt) noexcept {
     ERR_GUARD(err) {
-      if (*this == VALID)
+      if (*this == VALID) {
+        if (lane_ == VALID)
+          return impl_->acquire(err, *lane_, cnt);
         return impl_->acquire(err, user_, cnt);
+      }
       err = err::E_XXX;
     }
     return {};
   }
 
-  t_errn t_client::insert(t_chain chain) noexcept {
+  t_client::t_chain t_client::acquire(t_err err, r_wakeup wakeup,
+                                      t_n cnt) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID) {
+        t_chain chain = acquire(cnt);
+        if (!get(chain.cnt)) {
+          impl_->enqueue(err, wakeup);
+          if (!err) {
+            chain = acquire(cnt);
+            if (get(chain.cnt))
+              impl_->cancel(wakeup);
+          }
+        }
+        return chain;
+      }
+      err = err::E_XXX;
+    }
+    return {};
+  }
+
+  t_void t_client::cancel(r_wakeup wakeup) noexcept {
     if (*this == VALID)
+      impl_->cancel(wakeup);
+  }
+
+  t_errn t_client::insert(t_chain chain) noexcept {
+    if (*this == VALID) {
+      if (lane_ == VALID)
+        return impl_->insert(*lane_, chain);
       return impl_->insert(user_, chain);
+    }
     return t_errn{-1};
   }
 
   t_void t_client::insert(t_err err, t_chain chain) noexcept {
     ERR_GUARD(err) {
-      if (*this == VALID)
-        impl_->insert(err, user_, chain);
-      else
+      if (*this == VALID) {
+        if (lane_ == VALID)
+          impl_->insert(err, *lane_, chain);
+        else
+          impl_->insert(err, user_, chain);
+      } else
         err = err::E_XXX;
     }
   }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-  t_processor::t_processor(t_err err, t_n max) noexcept {
+  t_void t_processor::t_logic::async_process_batch(r_chains chains) noexcept {
+    for (auto& chain : chains)
+      async_process(chain);
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  t_processor::t_processor(t_err err, t_n max, t_mode mode) noexcept
+    : t_processor{err, t_params{max, mode}} {
+  }
+
+  t_processor::t_processor(t_err err, R_params params) noexcept {
     ERR_GUARD(err) {
-      impl_ = new t_impl_(err, max);
+      impl_ = new t_impl_(err, params);
       if (impl_ == VALID) {
         if (err)
           impl_.clear();
@@ -251,6 +1030,16 @@ namespace chained_queue
     return {};
   }
 
+  t_client t_processor::make_lane_client(t_err err, t_user user,
+                                         t_n max) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->make_lane_client(err, user, max);
+      err = err::E_XXX;
+    }
+    return {};
+  }
+
   t_void t_processor::process(t_err err, r_logic logic, t_n max) noexcept {
     ERR_GUARD(err) {
       if (*this == VALID)
@@ -269,6 +1058,15 @@ namespace chained_queue
     }
   }
 
+  t_n t_processor::drain(t_err err, r_logic logic, t_n max_items) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->drain(err, logic, max_items);
+      err = err::E_XXX;
+    }
+    return t_n{0};
+  }
+
   t_fd t_processor::get_fd() const noexcept {
     if (*this == VALID)
       return impl_->get_fd();
@@ -27,6 +27,8 @@
 #ifndef _DAINTY_MT_CHAINED_QUEUE_H_
 #define _DAINTY_MT_CHAINED_QUEUE_H_
 
+#include <vector>
+#include <utility>
 #include "dainty_named_ptr.h"
 #include "dainty_named_utility.h"
 #include "dainty_container_any.h"
@@ -42,6 +44,7 @@ namespace chained_queue
   using named::t_fd;
   using named::t_n;
   using named::t_void;
+  using named::t_bool;
   using named::t_validity;
   using named::VALID;
   using named::INVALID;
@@ -53,8 +56,65 @@ namespace chained_queue
   enum  t_user_tag_ { };
   using t_user = named::t_user<t_user_tag_>;
 
-  using t_any   = container::any::t_any;
-  using t_chain = container::chained_queue::t_chain<t_any>;
+  using t_any    = container::any::t_any;
+  using t_chain  = container::chained_queue::t_chain<t_any>;
+  using t_chains = std::vector<t_chain>;
+  using r_chains = named::t_prefix<t_chains>::r_;
+
+  // MUTEX_MODE:    free and ready list are guarded by a mutex each.
+  // LOCKFREE_MODE: free and ready list are bounded lock-free rings of
+  //                single slot chains, as the container cannot relink its
+  //                chains from outside. a chain of more than one slot takes
+  //                the MUTEX_MODE path through a second container of max
+  //                slots, so only single slot producers are lock-free.
+  enum t_mode { MUTEX_MODE, LOCKFREE_MODE };
+
+  // EMPTY_SIGNAL: (MUTEX_MODE) the eventfd is written for every insert into
+  //               an empty queue and read for every chain processed.
+  // ARMED_SIGNAL: (MUTEX_MODE) the consumer arms the eventfd when it finds
+  //               the queue empty. only the first insert after that writes
+  //               it; while the consumer drains, inserts make no syscall.
+  //
+  //               LOCKFREE_MODE always coalesces on its pending counts.
+  enum t_signal { EMPTY_SIGNAL, ARMED_SIGNAL };
+
+  // nanoseconds the consumer polls for work before it blocks on the
+  // eventfd. used with ARMED_SIGNAL and LOCKFREE_MODE.
+  enum  t_spin_tag_ { };
+  using t_spin_ = named::t_uint64;
+  using t_spin  = named::t_explicit<t_spin_, t_spin_tag_>;
+
+  // PACKED_LAYOUT: ring cells and single slot items of LOCKFREE_MODE and
+  //                of lanes are packed.
+  // PADDED_LAYOUT: every ring cell and every single slot item gets its own
+  //                cache line. LOCKFREE_MODE only: the slots of the container
+  //                (MUTEX_MODE, multi slot chains) cannot be padded and a
+  //                MUTEX_MODE processor refuses it (E_XXX).
+  //
+  //                head, tail and list metadata are always kept apart.
+  //                dainty_mt_chained_queue_bench.cpp compares both layouts.
+  enum t_layout { PACKED_LAYOUT, PADDED_LAYOUT };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_params {
+  public:
+    t_n      max;
+    t_mode   mode;
+    t_n      max_lanes; // LOCKFREE_MODE only, see make_lane_client
+    t_signal signal;
+    t_spin   spin;
+    t_layout layout;
+
+    inline
+    t_params(t_n _max, t_mode _mode = MUTEX_MODE, t_n _max_lanes = t_n{0},
+             t_signal _signal = EMPTY_SIGNAL, t_spin _spin = t_spin{0},
+             t_layout _layout = PACKED_LAYOUT)
+      : max(_max), mode(_mode), max_lanes(_max_lanes), signal(_signal),
+        spin(_spin), layout(_layout) {
+    }
+  };
+  using R_params = named::t_prefix<t_params>::R_;
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -66,6 +126,32 @@ namespace chained_queue
   using t_impl_owner_ = named::ptr::t_ptr<t_impl_, t_impl_owner_tag_,
                                           named::ptr::t_deleter>;
 
+  class t_lane_;
+  enum  t_lane_user_tag_ { };
+  using t_lane_user_ = named::ptr::t_ptr<t_lane_, t_lane_user_tag_,
+                                         named::ptr::t_no_deleter>;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // queued by acquire(t_err, r_wakeup, n) when too few slots are free.
+  // the next release of any slot calls wake once, from the releasing thread
+  // with the free list locked, keep it short. acquire again after it.
+  class t_wakeup;
+  using r_wakeup = t_prefix<t_wakeup>::r_;
+  using p_wakeup = t_prefix<t_wakeup>::p_;
+
+  class t_wakeup {
+  public:
+    virtual ~t_wakeup() { }
+    virtual t_void wake() noexcept = 0;
+
+  private:
+    friend class t_impl_;
+    p_wakeup prev_   = nullptr;
+    p_wakeup next_   = nullptr;
+    t_bool   queued_ = false;
+  };
+
 ///////////////////////////////////////////////////////////////////////////////
 
   class t_client;
@@ -84,19 +170,36 @@ namespace chained_queue
 
     operator t_validity() const noexcept;
 
+    // LOCKFREE_MODE: n > 1 is served under a mutex, see t_mode.
     t_chain acquire(       t_n = t_n{1}) noexcept;
     t_chain acquire(t_err, t_n = t_n{1}) noexcept;
 
+    // as acquire, but when too few slots are free wakeup is queued and an
+    // empty chain is returned without err. cancel dequeues a wakeup that
+    // is no longer wanted; a woken one is dequeued already.
+    t_chain acquire(t_err, r_wakeup, t_n = t_n{1}) noexcept;
+    t_void  cancel (r_wakeup)                       noexcept;
+
     t_errn  insert (       t_chain)      noexcept;
     t_void  insert (t_err, t_chain)      noexcept;
 
+    // acquire a slot, construct a T from args directly in its t_any with
+    // t_any::emplace<T> and insert it. the payload is built once, it is not
+    // made elsewhere and then moved in.
+    template<typename T, typename... Args>
+    t_errn  emplace(       Args&&...) noexcept;
+    template<typename T, typename... Args>
+    t_void  emplace(t_err, Args&&...) noexcept;
+
   private:
     friend class t_processor;
     friend class t_impl_;
     t_client() = default;
     t_client(t_impl_user_, t_user) noexcept;
+    t_client(t_impl_user_, t_lane_user_, t_user) noexcept;
 
     t_impl_user_ impl_;
+    t_lane_user_ lane_;
     t_user       user_ = t_user{0L};
   };
 
@@ -111,16 +214,19 @@ namespace chained_queue
   public:
     class t_logic {
     public:
-      using t_chain = chained_queue::t_chain;
+      using t_chain  = chained_queue::t_chain;
+      using r_chains = chained_queue::r_chains;
 
       virtual ~t_logic() { }
-      virtual t_void async_process(t_chain) noexcept = 0;
+      virtual t_void async_process      (t_chain)  noexcept = 0;
+      virtual t_void async_process_batch(r_chains) noexcept; // used by drain
     };
 
     using r_logic = t_logic&;
 
-     t_processor(t_err, t_n max) noexcept;
-     t_processor(x_processor)    noexcept;
+     t_processor(t_err, t_n max, t_mode = MUTEX_MODE) noexcept;
+     t_processor(t_err, R_params)                      noexcept;
+     t_processor(x_processor)                          noexcept;
     ~t_processor();
 
     t_processor(R_processor)           = delete;
@@ -134,13 +240,50 @@ namespace chained_queue
     t_void process          (t_err, r_logic, t_n max = t_n{1}) noexcept;
     t_void process_available(t_err, r_logic) noexcept;
 
+    // take up to max_items chains with a single lock of the ready list,
+    // hand them to async_process_batch and release them in one go.
+    // max_items only bounds LOCKFREE_MODE. MUTEX_MODE takes the whole ready
+    // list, as a single chain that links every inserted chain.
+    t_n    drain            (t_err, r_logic, t_n max_items) noexcept;
+
     t_client make_client(       t_user) noexcept;
     t_client make_client(t_err, t_user) noexcept;
 
+    // a lane client must only be used from a single thread. it owns a
+    // private pool of max slots and a wait-free single producer lane that
+    // process drains round-robin with the other lanes. lanes live as long
+    // as the processor.
+    t_client make_lane_client(t_err, t_user, t_n max) noexcept;
+
   private:
     t_impl_owner_ impl_;
   };
 
+///////////////////////////////////////////////////////////////////////////////
+
+  template<typename T, typename... Args>
+  inline
+  t_errn t_client::emplace(Args&&... args) noexcept {
+    t_chain chain = acquire();
+    if (get(chain.cnt)) {
+      chain.head->ref().template emplace<T>(std::forward<Args>(args)...);
+      return insert(chain);
+    }
+    return t_errn{-1};
+  }
+
+  template<typename T, typename... Args>
+  inline
+  t_void t_client::emplace(t_err err, Args&&... args) noexcept {
+    ERR_GUARD(err) {
+      t_chain chain = acquire(err);
+      if (!err) {
+        chain.head->ref().template emplace<T>(std::forward<Args>(args)...);
+        insert(err, chain);
+      }
+    }
+  }
+
 ///////////////////////////////////////////////////////////////////////////////
 
 }
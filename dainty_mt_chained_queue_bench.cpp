@@ -0,0 +1,113 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// bench
+// throughput of a LOCKFREE_MODE processor with N producers that emplace
+// into a shared client, while a single consumer drains. every producer
+// count runs with PACKED_LAYOUT and with PADDED_LAYOUT, so the cost of
+// slots and ring cells that share cache lines shows as a difference in
+// messages per second.
+//
+// usage: bench [messages per producer] [max producers]
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include "dainty_mt_err.h"
+#include "dainty_mt_chained_queue.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::chained_queue;
+
+namespace
+{
+  using named::t_n_;
+  using named::t_uint64;
+
+  constexpr t_n_ SLOTS_ = 256;
+
+  struct t_logic_ : t_processor::t_logic {
+    t_uint64 received = 0;
+    t_uint64 sum      = 0;
+
+    t_void async_process(t_chain chain) noexcept override {
+      sum += chain.head->ref().ref<t_uint64>();
+      ++received;
+    }
+  };
+
+  t_void produce_(t_processor& processor, t_n_ id, t_uint64 msgs) {
+    auto client = processor.make_client(t_user{static_cast<long>(id)});
+    assert(client == VALID);
+    for (t_uint64 n = 1; n <= msgs; ++n)
+      while (client.emplace<t_uint64>(n) != VALID)
+        std::this_thread::yield(); // every slot is in flight
+  }
+
+  double run_(t_layout layout, t_n_ producers, t_uint64 msgs) {
+    err::t_err  err;
+    t_processor processor{err, t_params{t_n{SLOTS_}, LOCKFREE_MODE, t_n{0},
+                                        EMPTY_SIGNAL, t_spin{0}, layout}};
+    assert(!err && processor == VALID);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (t_n_ id = 0; id < producers; ++id)
+      threads.emplace_back(produce_, std::ref(processor), id + 1, msgs);
+
+    t_logic_ logic;
+    while (!err && logic.received < producers*msgs)
+      if (!get(processor.drain(err, logic, t_n{SLOTS_})))
+        std::this_thread::yield();
+    const auto stop = std::chrono::steady_clock::now();
+
+    for (auto& thread : threads)
+      thread.join();
+    assert(!err && logic.sum == producers*msgs*(msgs + 1)/2);
+
+    const std::chrono::duration<double> secs = stop - start;
+    return logic.received/secs.count();
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const t_uint64 msgs = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                 : 1000000;
+  const t_n_     max  = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+
+  std::printf("producers      packed msg/s      padded msg/s\n");
+  for (t_n_ producers = 1; producers <= max; producers <<= 1) {
+    const double packed = run_(PACKED_LAYOUT, producers, msgs);
+    const double padded = run_(PADDED_LAYOUT, producers, msgs);
+    std::printf("%9lu %17.0f %17.0f\n", producers, packed, padded);
+  }
+  return 0;
+}
@@ -0,0 +1,332 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// a LOCKFREE_MODE processor hands out and takes back single slot chains
+// through its rings and chains of more slots through the mutex path, for
+// plain and for lane clients, without one side starving the other. with
+// PADDED_LAYOUT every single slot item owns its cache line, and MUTEX_MODE
+// refuses the layout. emplace builds its payload in the slot, without
+// copying or moving it. lanes and the shared ring are drained round-robin
+// and every lane keeps its order, also when its producer runs on a thread
+// of its own. ARMED_SIGNAL and LOCKFREE_MODE write the eventfd once for a
+// burst of inserts. drain hands the ready list over in one batch and frees
+// every slot of it.
+
+#include <poll.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cassert>
+#include "dainty_mt_err.h"
+#include "dainty_mt_chained_queue.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::chained_queue;
+
+namespace
+{
+  using named::t_n_;
+
+  struct t_logic_ : t_processor::t_logic {
+    t_n_ chains = 0;
+    t_n_ slots  = 0;
+
+    t_void async_process(t_chain chain) noexcept override {
+      assert(get(chain.cnt));
+      ++chains;
+      slots += get(chain.cnt);
+    }
+  };
+
+  struct t_msg_ {
+    static std::atomic<t_n_> built;
+    static std::atomic<t_n_> moved;
+
+    t_n_ a, b;
+
+    t_msg_(t_n_ _a, t_n_ _b) : a(_a), b(_b) { ++built; }
+    t_msg_(const t_msg_& msg) : a(msg.a), b(msg.b) { ++moved; }
+    t_msg_(t_msg_&& msg)      : a(msg.a), b(msg.b) { ++moved; }
+  };
+  std::atomic<t_n_> t_msg_::built{0};
+  std::atomic<t_n_> t_msg_::moved{0};
+
+  // the source (a) and sequence number (b) of every t_msg_ handed to it.
+  struct t_order_ : t_processor::t_logic {
+    std::vector<t_n_> sources;
+    std::vector<t_n_> next;
+
+    t_order_(t_n_ max) : next(max, 0) { }
+
+    t_void async_process(t_chain chain) noexcept override {
+      assert(get(chain.cnt) == 1);
+      const t_msg_& msg = chain.head->ref().ref<t_msg_>();
+      assert(msg.a < next.size() && msg.b == next[msg.a]);
+      ++next[msg.a];
+      sources.push_back(msg.a);
+    }
+  };
+
+  t_void test_lockfree_(r_client client, t_processor& processor) {
+    err::t_err err;
+    t_logic_   logic;
+    for (t_n_ round = 0; round < 2; ++round) {
+      auto first  = client.acquire(err);
+      auto second = client.acquire(err);
+      assert(!err && get(first.cnt) == 1 && get(second.cnt) == 1);
+      assert(!get(client.acquire().cnt));
+
+      auto bulk = client.acquire(err, t_n{2});
+      assert(!err && get(bulk.cnt) == 2);
+      assert(!get(client.acquire(t_n{2}).cnt));
+
+      client.insert(err, first);
+      client.insert(err, bulk);
+      assert(client.insert(second) == VALID);
+      processor.process(err, logic, t_n{3});
+      assert(!err);
+    }
+    assert(logic.chains == 6 && logic.slots == 8);
+  }
+
+  t_void test_lockfree_() {
+    err::t_err  err;
+    t_processor processor{err, t_params{t_n{2}, LOCKFREE_MODE, t_n{1}}};
+    assert(!err && processor == VALID);
+
+    auto client = processor.make_client(err, t_user{1L});
+    assert(!err && client == VALID);
+    test_lockfree_(client, processor);
+
+    auto lane = processor.make_lane_client(err, t_user{2L}, t_n{2});
+    assert(!err && lane == VALID);
+    test_lockfree_(lane, processor);
+
+    // the bulk chains of both clients share the mutex path.
+    t_logic_ logic;
+    auto first  = client.acquire(err, t_n{2});
+    auto second = lane.acquire(t_n{2});
+    assert(!err && get(first.cnt) == 2 && !get(second.cnt));
+    client.insert(err, first);
+    processor.process(err, logic);
+    assert(!err && logic.chains == 1 && logic.slots == 2);
+  }
+
+  t_void test_layout_() {
+    err::t_err  err;
+    t_processor mutex{err, t_params{t_n{2}, MUTEX_MODE, t_n{0},
+                                    EMPTY_SIGNAL, t_spin{0}, PADDED_LAYOUT}};
+    assert(err && mutex != VALID);
+    err.clear();
+
+    t_processor processor{err, t_params{t_n{4}, LOCKFREE_MODE, t_n{0},
+                                        EMPTY_SIGNAL, t_spin{0},
+                                        PADDED_LAYOUT}};
+    assert(!err && processor == VALID);
+    auto client = processor.make_client(err, t_user{1L});
+    assert(!err && client == VALID);
+
+    const t_n_ line = 64;
+    t_n_ lines[4];
+    for (auto& ix : lines) {
+      auto chain = client.acquire(err);
+      assert(!err && get(chain.cnt) == 1);
+      const t_n_ addr = reinterpret_cast<t_n_>(chain.head);
+      assert(!(addr % line));
+      ix = addr/line;
+    }
+    for (t_n_ ix = 1; ix < 4; ++ix)
+      assert(lines[ix] != lines[ix - 1] && lines[ix] != lines[0]);
+  }
+
+  t_void test_lanes_fair_() {
+    err::t_err  err;
+    t_processor processor{err, t_params{t_n{4}, LOCKFREE_MODE, t_n{2}}};
+    assert(!err && processor == VALID);
+
+    t_client clients[] = {processor.make_client(err, t_user{1L}),
+                          processor.make_lane_client(err, t_user{2L}, t_n{4}),
+                          processor.make_lane_client(err, t_user{3L}, t_n{4})};
+    assert(!err);
+    assert(processor.make_lane_client(err, t_user{4L}, t_n{4}) != VALID);
+    assert(err);
+    err.clear();
+
+    for (t_n_ source = 0; source < 3; ++source)
+      for (t_n_ seq = 0; seq < 3; ++seq)
+        clients[source].emplace<t_msg_>(err, source, seq);
+    assert(!err);
+
+    t_order_ order{3};
+    processor.process(err, order, t_n{9});
+    assert(!err && order.sources.size() == 9);
+    for (t_n_ ix = 0; ix < 9; ix += 3) {
+      const t_n_* turn = &order.sources[ix];
+      assert(turn[0] != turn[1] && turn[1] != turn[2] && turn[0] != turn[2]);
+    }
+  }
+
+  t_void test_lanes_threads_() {
+    const t_n_ producers = 2, msgs = 10000;
+
+    err::t_err  err;
+    t_processor processor{err, t_params{t_n{8}, LOCKFREE_MODE,
+                                        t_n{producers}}};
+    assert(!err && processor == VALID);
+
+    std::vector<t_client> lanes;
+    for (t_n_ ix = 0; ix < producers; ++ix)
+      lanes.push_back(processor.make_lane_client(err, t_user{1L}, t_n{8}));
+    assert(!err);
+
+    std::vector<std::thread> threads;
+    for (t_n_ ix = 0; ix < producers; ++ix)
+      threads.emplace_back([&lanes, ix]() {
+        for (t_n_ seq = 0; seq < msgs; ++seq)
+          while (lanes[ix].emplace<t_msg_>(ix, seq) != VALID)
+            std::this_thread::yield(); // the lane is full
+      });
+
+    t_order_ order{producers};
+    while (!err && order.sources.size() < producers*msgs)
+      processor.process(err, order);
+    for (auto& thread : threads)
+      thread.join();
+    assert(!err && order.next[0] == msgs && order.next[1] == msgs);
+  }
+
+  // the eventfd count, which is written back so the consumer still finds it.
+  named::t_uint64 peek_(t_fd fd) {
+    pollfd pfd{get(fd), POLLIN, 0};
+    named::t_uint64 value = 0;
+    if (::poll(&pfd, 1, 0) == 1) {
+      assert(::read(get(fd), &value, sizeof(value)) == sizeof(value));
+      assert(::write(get(fd), &value, sizeof(value)) == sizeof(value));
+    }
+    return value;
+  }
+
+  t_void test_coalesced_(R_params params) {
+    err::t_err  err;
+    t_processor processor{err, params};
+    assert(!err && processor == VALID);
+    auto client = processor.make_client(err, t_user{1L});
+    assert(!err && client == VALID);
+
+    t_logic_ logic;
+    for (t_n_ round = 0; round < 2; ++round) {
+      assert(peek_(processor.get_fd()) == 0);
+      for (t_n_ n = 0; n < 3; ++n)
+        assert(client.insert(client.acquire()) == VALID);
+      assert(peek_(processor.get_fd()) == 1);
+
+      while (logic.slots < 3*(round + 1)) {
+        processor.process_available(err, logic);
+        assert(!err);
+      }
+      if (params.mode == MUTEX_MODE)
+        processor.process_available(err, logic); // finds it empty, re-arms
+      assert(!err);
+    }
+    assert(peek_(processor.get_fd()) == 0);
+  }
+
+  struct t_batch_logic_ : t_logic_ {
+    std::vector<t_n_> batches;
+
+    t_void async_process_batch(r_chains chains) noexcept override {
+      batches.push_back(chains.size());
+      t_logic_::async_process_batch(chains);
+    }
+  };
+
+  t_void test_drain_(t_mode mode) {
+    err::t_err  err;
+    t_processor processor{err, t_params{t_n{4}, mode}};
+    assert(!err && processor == VALID);
+    auto client = processor.make_client(err, t_user{1L});
+    assert(!err && client == VALID);
+
+    t_batch_logic_ logic;
+    assert(!get(processor.drain(err, logic, t_n{4})) && !err);
+    assert(logic.batches.empty());
+
+    for (t_n_ round = 0; round < 2; ++round) {
+      for (t_n_ n = 0; n < 4; ++n)
+        client.insert(err, client.acquire(err));
+      assert(!err && !get(client.acquire().cnt));
+
+      if (mode == MUTEX_MODE) {
+        assert(get(processor.drain(err, logic, t_n{2})) == 1);
+      } else {
+        assert(get(processor.drain(err, logic, t_n{3})) == 3);
+        assert(get(processor.drain(err, logic, t_n{3})) == 1);
+      }
+      assert(!err);
+    }
+    assert(logic.slots == 8);
+    if (mode == MUTEX_MODE)
+      assert((logic.batches == std::vector<t_n_>{1, 1}));
+    else
+      assert((logic.batches == std::vector<t_n_>{3, 1, 3, 1}));
+  }
+
+  t_void test_emplace_(t_mode mode) {
+    err::t_err  err;
+    t_processor processor{err, t_params{t_n{2}, mode}};
+    assert(!err && processor == VALID);
+
+    auto client = processor.make_client(err, t_user{1L});
+    assert(!err && client == VALID);
+
+    t_logic_ logic;
+    t_msg_::built = t_msg_::moved = 0;
+    for (t_n_ round = 0; round < 4; ++round) {
+      client.emplace<t_msg_>(err, round, round + 1);
+      assert(!err);
+      processor.process(err, logic);
+      assert(!err);
+    }
+    assert(logic.chains == 4 && t_msg_::built == 4 && !t_msg_::moved);
+  }
+}
+
+int main() {
+  test_lockfree_();
+  test_layout_();
+  test_lanes_fair_();
+  test_lanes_threads_();
+  test_coalesced_(t_params{t_n{4}, MUTEX_MODE, t_n{0}, ARMED_SIGNAL});
+  test_coalesced_(t_params{t_n{4}, LOCKFREE_MODE});
+  test_drain_(MUTEX_MODE);
+  test_drain_(LOCKFREE_MODE);
+  test_emplace_(MUTEX_MODE);
+  test_emplace_(LOCKFREE_MODE);
+  return 0;
+}
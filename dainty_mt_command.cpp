@@ -24,9 +24,12 @@
 
 ******************************************************************************/
 
+#include <vector>
+#include <atomic>
 #include "dainty_os_fdbased.h"
 #include "dainty_os_threading.h"
 #include "dainty_mt_command.h"
+#include "dainty_mt_internal_.h"
 
 namespace dainty
 {
@@ -35,19 +38,181 @@ namespace mt
 namespace command
 {
   using err::r_err;
+  using named::t_n_;
+  using internal_::cpu_relax_;
   using namespace dainty::os::threading;
   using namespace dainty::os::fdbased;
 
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_completion_impl_ {
+  public:
+    t_completion_impl_(r_err err) noexcept
+      : lock_{err}, cond_{err}, eventfd_(err, t_n{0}) {
+      if (lock_ == VALID && cond_ == VALID && eventfd_ == VALID)
+        valid_ = VALID;
+    }
+
+    operator t_validity() const noexcept {
+      return valid_;
+    }
+
+    t_fd get_fd() const noexcept {
+      return eventfd_.get_fd();
+    }
+
+    t_bool is_done() const noexcept {
+      return done_.load(std::memory_order_acquire);
+    }
+
+    t_bool has_failed() const noexcept {
+      return is_done() && failed_;
+    }
+
+    // a wait returns once complete is done with it, see complete.
+    t_errn wait() noexcept {
+      t_errn errn{-1};
+      <% auto scope = lock_.make_locked_scope();
+        if (scope == VALID) {
+          set(errn) = 0;
+          while (errn == VALID && !finished_)
+            errn = cond_.wait(lock_);
+        }
+      %>
+      if (errn == VALID)
+        settle_();
+      return errn;
+    }
+
+    t_void wait(r_err err) noexcept {
+      <% auto scope = lock_.make_locked_scope(err);
+        while (!err && !finished_)
+          cond_.wait(err, lock_);
+      %>
+      if (!err)
+        settle_();
+    }
+
+    t_errn wait(t_time timeout) noexcept {
+      t_errn errn{-1};
+      const t_time deadline = os::clock::monotonic_now() + timeout;
+      <% auto scope = lock_.make_locked_scope();
+        if (scope == VALID) {
+          set(errn) = 0;
+          while (errn == VALID && !finished_) {
+            const t_time now = os::clock::monotonic_now();
+            if (now < deadline)
+              errn = cond_.wait_for(lock_, deadline - now);
+            else
+              set(errn) = -1;
+          }
+        }
+      %>
+      if (errn == VALID)
+        settle_();
+      return errn;
+    }
+
+    t_void wait(r_err err, t_time timeout) noexcept {
+      const t_time deadline = os::clock::monotonic_now() + timeout;
+      <% auto scope = lock_.make_locked_scope(err);
+        while (!err && !finished_) {
+          const t_time now = os::clock::monotonic_now();
+          if (now < deadline)
+            cond_.wait_for(err, lock_, deadline - now);
+          else
+            err = err::E_TIMEOUT;
+        }
+        if (err && err.id() == os::err::E_TIMEOUT) {
+          err.clear();
+          err = err::E_TIMEOUT;
+        }
+      %>
+      if (!err)
+        settle_();
+    }
+
+    t_void reset() noexcept {
+      <% auto scope = lock_.make_locked_scope();
+        if (scope == VALID && !pending_ && is_done()) {
+          t_eventfd::t_value value = 0;
+          eventfd_.read(value); // written by complete, so it cannot block
+          failed_   = false;
+          finished_ = false;
+          done_.store(false, std::memory_order_relaxed);
+        }
+      %>
+    }
+
+    t_bool begin() noexcept {
+      <% auto scope = lock_.make_locked_scope();
+        if (scope == VALID && !pending_ && !finished_) {
+          pending_ = true;
+          return true;
+        }
+      %>
+      return false;
+    }
+
+    // the request was not queued after all.
+    t_void abort() noexcept {
+      <% auto scope = lock_.make_locked_scope();
+        if (scope == VALID)
+          pending_ = false;
+      %>
+    }
+
+    // the requester may destroy or reset the completion as soon as it sees
+    // done_, so done_ is stored last and nothing is touched after it. one
+    // that only saw the eventfd or finished_ is held back by settle_.
+    t_void complete(t_bool failed) noexcept {
+      <% auto scope = lock_.make_locked_scope();
+        failed_   = failed;
+        pending_  = false;
+        finished_ = true;
+        cond_.broadcast();
+        t_eventfd::t_value value = 1;
+        eventfd_.write(value);
+      %>
+      done_.store(true, std::memory_order_release);
+    }
+
+    ~t_completion_impl_() {
+      <% auto scope = lock_.make_locked_scope();
+        if (scope == VALID && finished_)
+          settle_();
+      %>
+    }
+
+  private:
+    t_void settle_() const noexcept {
+      while (!is_done())
+        cpu_relax_();
+    }
+
+    t_validity           valid_    = INVALID;
+    t_mutex_lock         lock_;
+    t_monotonic_cond_var cond_;
+    t_eventfd            eventfd_;
+    t_bool               pending_  = false;
+    t_bool               failed_   = false;
+    t_bool               finished_ = false; // under lock_, done_ follows
+    std::atomic<t_bool>  done_{false};
+  };
+  using p_completion_impl_ = t_completion_impl_*;
+
 ///////////////////////////////////////////////////////////////////////////////
 
   class t_impl_ {
   public:
     using r_logic = t_processor::r_logic;
 
-    t_impl_(r_err err) noexcept
-      : cmdlock_(err), condlock_(err), cond_(err), eventfd_(err, t_n{0}) {
+    t_impl_(r_err err, t_n max) noexcept
+      : cmdlock_(err), condlock_(err), cond_(err), space_(err),
+        eventfd_(err, t_n{0}), max_{get(max)} {
+      queue_.resize(max_);
       if (cmdlock_ == VALID && condlock_ == VALID && cond_ == VALID &&
-          eventfd_ == VALID)
+          space_ == VALID && eventfd_ == VALID && max_)
         valid_ = VALID;
     }
 
@@ -59,25 +224,51 @@ namespace command
       for (t_n_ n = get(max); !err && n; --n) {
         t_eventfd::t_value value = 0;
         eventfd_.read(err, value);
+
+        t_n_ cnt = 0;
         <% auto scope = condlock_.make_locked_scope(err);
           if (!err) {
-            if (wait_) {
-              if (async_) {
-                p_command cmd = named::utility::reset(cmd_);
-                t_user user = user_;
-                cond_.signal(err);
-                logic.async_process(user, cmd);
-              } else {
-                logic.process(err, user_, *cmd_);
-                named::utility::reset(cmd_);
-                cond_.signal();
-              }
-            } else {
-              cmd_ = nullptr;
+            signalled_ = false;
+            cnt        = cnt_;
+            if (wait_ && cmd_) {
+              logic.process(err, user_, *cmd_);
+              named::utility::reset(cmd_);
+              cond_.signal();
+            } else if (!cnt)
               err = err::E_XXX;
-            }
           }
         %>
+
+        // producers only append behind these, so they are stable.
+        for (t_n_ ix = 0; ix < cnt; ++ix) {
+          t_entry_& entry = queue_[(head_ + ix) % max_];
+          p_command cmd   = named::utility::reset(entry.cmd);
+          if (entry.completion) {
+            t_err result;
+            logic.process(result, entry.user, *cmd);
+            t_bool failed = false;
+            if (result) {
+              failed = true;
+              result.clear();
+            }
+            named::utility::reset(entry.completion)->complete(failed);
+          } else
+            logic.async_process(entry.user, cmd);
+        }
+
+        // err may hold a failure of the logic by now. the entries must
+        // still be retired under the lock that producers append under.
+        if (cnt) {
+          <% auto scope = condlock_.make_locked_scope();
+            if (scope == VALID) {
+              head_  = (head_ + cnt) % max_;
+              cnt_  -= cnt;
+              if (full_waiting_)
+                space_.broadcast();
+            } else if (!err)
+              err = err::E_XXX;
+          %>
+        }
       }
     }
 
@@ -87,11 +278,9 @@ namespace command
           if (!err) {
             user_  = user;
             cmd_   = &cmd;
-            async_ = false;
             wait_  = true;
 
-            t_eventfd::t_value value = 1;
-            eventfd_.write(err, value);
+            signal_(err);
 
             while (!err && cmd_)
               cond_.wait(err, condlock_);
@@ -102,50 +291,33 @@ namespace command
       %>
     }
 
-    t_errn async_request(t_user user, p_command cmd) noexcept {
+    t_errn request(t_user user, p_completion_impl_ completion,
+                   r_command cmd) noexcept {
       t_errn errn{-1};
-      <% auto scope = cmdlock_.make_locked_scope();
-        if (scope == VALID) {
-          <% auto scope = condlock_.make_locked_scope();
-            if (scope == VALID) {
-              user_  = user;
-              cmd_   = cmd;
-              async_ = true;
-              wait_  = true;
-
-              t_eventfd::t_value value = 1;
-              errn = eventfd_.write(value);
-
-              while (errn == VALID && cmd_)
-                errn = cond_.wait(condlock_);
-
-              wait_ = false;
-            }
-          %>
-        }
-      %>
+      if (completion->begin()) {
+        errn = enqueue_(user, &cmd, completion);
+        if (errn != VALID)
+          completion->abort();
+      }
       return errn;
     }
 
-    t_void async_request(r_err err, t_user user, p_command cmd) noexcept {
-      <% auto scope = cmdlock_.make_locked_scope(err);
-        <% auto scope = condlock_.make_locked_scope(err);
-          if (!err) {
-            user_  = user;
-            cmd_   = cmd;
-            async_ = true;
-            wait_  = true;
-
-            t_eventfd::t_value value = 1;
-            eventfd_.write(err, value);
+    t_void request(r_err err, t_user user, p_completion_impl_ completion,
+                   r_command cmd) noexcept {
+      if (completion->begin()) {
+        enqueue_(err, user, &cmd, completion);
+        if (err)
+          completion->abort();
+      } else
+        err = err::E_XXX;
+    }
 
-            while (!err && cmd_)
-              cond_.wait(err, condlock_);
+    t_errn async_request(t_user user, p_command cmd) noexcept {
+      return enqueue_(user, cmd, nullptr);
+    }
 
-            wait_  = false;
-          }
-        %>
-      %>
+    t_void async_request(r_err err, t_user user, p_command cmd) noexcept {
+      enqueue_(err, user, cmd, nullptr);
     }
 
     t_fd get_fd() const noexcept {
@@ -163,17 +335,171 @@ namespace command
     }
 
   private:
-    t_validity   valid_ = INVALID;
-    t_mutex_lock cmdlock_;
-    t_mutex_lock condlock_;
-    t_cond_var   cond_;
-    t_eventfd    eventfd_;
-    p_command    cmd_   = nullptr;
-    t_user       user_  = t_user{0L};
-    t_bool       async_ = false;
-    t_bool       wait_  = false;
+    struct t_entry_ {
+      t_user             user       = t_user{0L};
+      p_command          cmd        = nullptr;
+      p_completion_impl_ completion = nullptr;
+    };
+
+    t_errn enqueue_(t_user user, p_command cmd,
+                    p_completion_impl_ completion) noexcept {
+      t_errn errn{-1};
+      <% auto scope = condlock_.make_locked_scope();
+        if (scope == VALID) {
+          set(errn) = 0;
+          if (cnt_ == max_) {
+            ++full_waiting_;
+            while (errn == VALID && cnt_ == max_)
+              errn = space_.wait(condlock_);
+            --full_waiting_;
+          }
+          if (errn == VALID) {
+            push_(user, cmd, completion);
+            errn = signal_();
+          }
+        }
+      %>
+      return errn;
+    }
+
+    t_void enqueue_(r_err err, t_user user, p_command cmd,
+                    p_completion_impl_ completion) noexcept {
+      <% auto scope = condlock_.make_locked_scope(err);
+        if (!err) {
+          if (cnt_ == max_) {
+            ++full_waiting_;
+            while (!err && cnt_ == max_)
+              space_.wait(err, condlock_);
+            --full_waiting_;
+          }
+          if (!err) {
+            push_(user, cmd, completion);
+            signal_(err);
+          }
+        }
+      %>
+    }
+
+    // condlock_ is held by the caller.
+    t_void push_(t_user user, p_command cmd,
+                 p_completion_impl_ completion) noexcept {
+      t_entry_& entry  = queue_[(head_ + cnt_++) % max_];
+      entry.user       = user;
+      entry.cmd        = cmd;
+      entry.completion = completion;
+    }
+
+    // condlock_ is held by the caller. one write per wakeup of the
+    // processor, it takes everything queued up to then.
+    t_errn signal_() noexcept {
+      if (!signalled_) {
+        t_eventfd::t_value value = 1;
+        t_errn errn = eventfd_.write(value);
+        signalled_ = errn == VALID;
+        return errn;
+      }
+      return t_errn{0};
+    }
+
+    t_void signal_(r_err err) noexcept {
+      if (!signalled_) {
+        t_eventfd::t_value value = 1;
+        eventfd_.write(err, value);
+        signalled_ = !err;
+      }
+    }
+
+    t_validity            valid_ = INVALID;
+    t_mutex_lock          cmdlock_;
+    t_mutex_lock          condlock_;
+    t_cond_var            cond_;
+    t_cond_var            space_;
+    t_eventfd             eventfd_;
+    p_command             cmd_   = nullptr;
+    t_user                user_  = t_user{0L};
+    t_bool                wait_  = false;
+    t_bool                signalled_ = false;
+    const t_n_            max_;
+    std::vector<t_entry_> queue_;
+    t_n_                  head_ = 0;
+    t_n_                  cnt_  = 0;
+    t_n_                  full_waiting_ = 0;
   };
 
+///////////////////////////////////////////////////////////////////////////////
+
+  t_completion::t_completion(t_err err) noexcept {
+    ERR_GUARD(err) {
+      impl_ = new t_completion_impl_(err);
+      if (impl_ == VALID) {
+        if (err)
+          impl_.clear();
+      } else
+        err = err::E_XXX;
+    }
+  }
+
+  t_completion::t_completion(x_completion completion) noexcept
+    : impl_(completion.impl_.release()) {
+  }
+
+  t_completion::~t_completion() {
+    impl_.clear();
+  }
+
+  t_completion::operator t_validity() const noexcept {
+    return impl_ == VALID && *impl_ == VALID ? VALID : INVALID;
+  }
+
+  t_fd t_completion::get_fd() const noexcept {
+    if (*this == VALID)
+      return impl_->get_fd();
+    return BAD_FD;
+  }
+
+  t_bool t_completion::is_done() const noexcept {
+    return *this == VALID && impl_->is_done();
+  }
+
+  t_bool t_completion::has_failed() const noexcept {
+    return *this == VALID && impl_->has_failed();
+  }
+
+  t_errn t_completion::wait() noexcept {
+    if (*this == VALID)
+      return impl_->wait();
+    return t_errn{-1};
+  }
+
+  t_void t_completion::wait(t_err err) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->wait(err);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_errn t_completion::wait(t_time timeout) noexcept {
+    if (*this == VALID)
+      return impl_->wait(timeout);
+    return t_errn{-1};
+  }
+
+  t_void t_completion::wait(t_err err, t_time timeout) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->wait(err, timeout);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_void t_completion::reset() noexcept {
+    if (*this == VALID)
+      impl_->reset();
+  }
+
 ///////////////////////////////////////////////////////////////////////////////
 
   t_client::t_client(t_impl_user_ impl, t_user user) noexcept
@@ -198,6 +524,23 @@ namespace command
     }
   }
 
+  t_errn t_client::request(r_completion completion,
+                           r_command cmd) noexcept {
+    if (*this == VALID && completion == VALID)
+      return impl_->request(user_, &*completion.impl_, cmd);
+    return t_errn{-1};
+  }
+
+  t_void t_client::request(t_err err, r_completion completion,
+                           r_command cmd) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID && completion == VALID)
+        impl_->request(err, user_, &*completion.impl_, cmd);
+      else
+        err = err::E_XXX;
+    }
+  }
+
   t_errn t_client::async_request(p_command cmd) noexcept {
     if (*this == VALID)
       return impl_->async_request(user_, cmd);
@@ -215,9 +558,9 @@ namespace command
 
 ///////////////////////////////////////////////////////////////////////////////
 
-  t_processor::t_processor(t_err err) noexcept {
+  t_processor::t_processor(t_err err, t_n max) noexcept {
     ERR_GUARD(err) {
-      impl_ = new t_impl_(err);
+      impl_ = new t_impl_(err, max);
       if (impl_ == VALID) {
         if (err)
           impl_.clear();
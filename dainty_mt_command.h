@@ -29,6 +29,7 @@
 
 #include "dainty_named_ptr.h"
 #include "dainty_named_utility.h"
+#include "dainty_os_clock.h"
 #include "dainty_mt_err.h"
 
 namespace dainty
@@ -39,6 +40,7 @@ namespace command
 {
   using named::t_n;
   using named::t_void;
+  using named::t_bool;
   using named::t_validity;
   using named::VALID;
   using named::INVALID;
@@ -46,6 +48,7 @@ namespace command
   using named::t_errn;
   using named::t_fd;
   using err::t_err;
+  using os::clock::t_time;
 
   enum  t_user_tag_ { };
   using t_user = named::t_user<t_user_tag_>;
@@ -74,6 +77,51 @@ namespace command
   using t_impl_owner_ = named::ptr::t_ptr<t_impl_, t_impl_owner_tag_,
                                           named::ptr::t_deleter>;
 
+  class t_completion_impl_;
+  enum  t_completion_impl_owner_tag_ { };
+  using t_completion_impl_owner_ =
+    named::ptr::t_ptr<t_completion_impl_, t_completion_impl_owner_tag_,
+                      named::ptr::t_deleter>;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_completion;
+  using r_completion = t_prefix<t_completion>::r_;
+  using x_completion = t_prefix<t_completion>::x_;
+  using R_completion = t_prefix<t_completion>::R_;
+
+  // outcome of a request(r_completion, r_command). the completion and the
+  // command must stay alive until it is done. it can be polled, waited on,
+  // or its fd can be added to an event_dispatcher.
+  class t_completion {
+  public:
+     t_completion(t_err)        noexcept;
+     t_completion(x_completion) noexcept;
+    ~t_completion();
+
+    t_completion(R_completion)           = delete;
+    r_completion operator=(R_completion) = delete;
+    r_completion operator=(x_completion) = delete;
+
+    operator t_validity() const noexcept;
+
+    t_fd   get_fd    () const noexcept; // readable once done
+    t_bool is_done   () const noexcept;
+    t_bool has_failed() const noexcept; // the logic set an error
+
+    t_errn wait(       )                noexcept;
+    t_void wait(t_err  )                noexcept;
+    t_errn wait(       t_time timeout)  noexcept;
+    t_void wait(t_err, t_time timeout)  noexcept; // E_TIMEOUT
+
+    // reuse it for a next request, once the previous one is done.
+    t_void reset() noexcept;
+
+  private:
+    friend class t_client;
+    t_completion_impl_owner_ impl_;
+  };
+
 ///////////////////////////////////////////////////////////////////////////////
 
   class t_client;
@@ -91,6 +139,14 @@ namespace command
     operator t_validity() const noexcept;
 
     t_void request      (t_err, r_command) noexcept;
+
+    // returns once the command is queued, like async_request, but the
+    // processor handles it with process and reports on the completion.
+    t_errn request      (       r_completion, r_command) noexcept;
+    t_void request      (t_err, r_completion, r_command) noexcept;
+
+    // returns as soon as the command is queued. blocks only while the
+    // queue of the processor is full.
     t_errn async_request(       p_command) noexcept;
     t_void async_request(t_err, p_command) noexcept;
 
@@ -128,8 +184,9 @@ namespace command
 
     using r_logic = named::t_prefix<t_logic>::r_;
 
-     t_processor(t_err)       noexcept;
-     t_processor(x_processor) noexcept;
+    // max: async commands that can be queued before async_request blocks.
+     t_processor(t_err, t_n max = t_n{64}) noexcept;
+     t_processor(x_processor)              noexcept;
     ~t_processor();
 
     t_processor(R_processor)           = delete;
@@ -140,6 +197,7 @@ namespace command
 
     t_fd get_fd() const noexcept;
 
+    // every wakeup handles a pending request and all queued async commands.
     t_void process(t_err, r_logic, t_n max = t_n{1}) noexcept;
 
     t_client make_client(       t_user) noexcept;
@@ -0,0 +1,153 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// async commands queued around a sync request that fails are all handled,
+// and the processor keeps going after the failure. a completion reports
+// the outcome, can be reset and reused, and can be destroyed as soon as it
+// is seen done, whether through is_done or its fd.
+
+#include <poll.h>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cassert>
+#include "dainty_mt_command.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::command;
+
+namespace
+{
+  using named::t_n_;
+
+  enum t_cmd_id_ : t_id { ASYNC_, FAIL_, QUIT_ };
+
+  struct t_logic_ : t_processor::t_logic {
+    std::atomic<t_n_> async{0};
+    t_n_              failed = 0;
+    t_bool            quit   = false;
+
+    t_void process(t_err err, t_user, r_command cmd) noexcept override {
+      if (cmd.id == FAIL_) {
+        ++failed;
+        err = err::E_XXX;
+      } else if (cmd.id == QUIT_)
+        quit = true;
+    }
+
+    t_void async_process(t_user, p_command cmd) noexcept override {
+      assert(cmd->id == ASYNC_);
+      async.fetch_add(1);
+    }
+  };
+
+  t_void run_(t_processor& processor, t_logic_& logic) {
+    while (!logic.quit) {
+      err::t_err err;
+      processor.process(err, logic);
+      err.clear();
+    }
+  }
+
+  t_bool readable_(t_fd fd) {
+    ::pollfd pfd = { get(fd), POLLIN, -1 };
+    return ::poll(&pfd, 1, -1) == 1;
+  }
+
+  t_void test_mix_(r_client client) {
+    static t_command async{ASYNC_}; // may be handled after we return
+    err::t_err err;
+    t_command  fail{FAIL_};
+    for (t_n_ round = 0; round < 100; ++round) {
+      for (t_n_ n = 0; n < 5; ++n)
+        client.async_request(err, &async);
+      client.request(err, fail);
+      assert(!err);
+    }
+    for (t_n_ n = 0; n < 20; ++n)
+      client.async_request(err, &async);
+    assert(!err);
+  }
+
+  t_void test_completion_(r_client client) {
+    err::t_err   err;
+    t_completion completion{err};
+    t_command    ok{ASYNC_ + 100}, fail{FAIL_};
+    assert(!err && completion == VALID && !completion.is_done());
+
+    client.request(err, completion, fail);
+    assert(!err);
+    assert(client.request(completion, ok) != VALID); // still pending
+    completion.wait(err);
+    assert(!err && completion.is_done() && completion.has_failed());
+    assert(readable_(completion.get_fd()));
+
+    completion.reset();
+    assert(!completion.is_done() && !completion.has_failed());
+    assert(client.request(completion, ok) == VALID);
+    completion.wait(err);
+    assert(!err && completion.is_done() && !completion.has_failed());
+  }
+
+  // a requester that stops looking at a completion once it saw it done.
+  t_void test_destroy_when_done_(r_client client) {
+    t_command ok{ASYNC_ + 100};
+    for (t_n_ round = 0; round < 1000; ++round) {
+      err::t_err err;
+      std::unique_ptr<t_completion> completion{new t_completion{err}};
+      client.request(err, *completion, ok);
+      assert(!err);
+      if (round % 2)
+        while (!completion->is_done())
+          ;
+      else
+        assert(readable_(completion->get_fd()));
+    }
+  }
+}
+
+int main() {
+  err::t_err  err;
+  t_processor processor{err, t_n{8}};
+  t_logic_    logic;
+  assert(!err && processor == VALID);
+  std::thread thread{run_, std::ref(processor), std::ref(logic)};
+
+  t_client client = processor.make_client(err, t_user{1L});
+  test_mix_(client);
+  test_completion_(client);
+  test_destroy_when_done_(client);
+
+  t_command quit{QUIT_};
+  client.request(err, quit);
+  thread.join();
+
+  assert(!err && logic.failed == 101);
+  assert(logic.async.load() == 100*5 + 20);
+  return 0;
+}
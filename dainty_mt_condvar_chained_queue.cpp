@@ -24,9 +24,11 @@
 
 ******************************************************************************/
 
+#include <atomic>
 #include "dainty_named_utility.h"
 #include "dainty_os_threading.h"
 #include "dainty_mt_condvar_chained_queue.h"
+#include "dainty_mt_internal_.h"
 
 namespace dainty
 {
@@ -37,6 +39,7 @@ namespace condvar_chained_queue
   using err::r_err;
   using named::t_n_;
   using namespace os::threading;
+  using internal_::spin_wait_;
   using t_queue = container::chained_queue::t_chained_queue<t_any>;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -46,8 +49,8 @@ namespace condvar_chained_queue
     using t_chain = t_queue::t_chain;
     using r_logic = t_processor::r_logic;
 
-    t_impl_(r_err err, t_n max) noexcept :
-      queue_{err, max}, cond_{err}, lock1_{err}, lock2_{err} {
+    t_impl_(r_err err, t_n max, t_spin spin) noexcept :
+      spin_{spin}, queue_{err, max}, cond_{err}, lock1_{err}, lock2_{err} {
       if (queue_ == VALID && cond_ == VALID && lock1_ == VALID &&
           lock2_ == VALID)
         valid_ = VALID;
@@ -59,10 +62,16 @@ namespace condvar_chained_queue
 
     t_void process(r_err err, r_logic logic, t_n max) noexcept {
       for (t_n_ n = get(max); !err && n; --n) {
+        spin_wait_(get(spin_), [this]() {
+          return pending_.load(std::memory_order_acquire) != 0; });
+
         t_chain chain;
         <% auto scope = lock2_.make_locked_scope(err);
-          cond_.wait(err, lock2_);
+          while (!err && queue_.is_empty())
+            cond_.wait(err, lock2_);
           chain = queue_.remove(err);
+          if (get(chain.cnt)) // remove takes all chains, none are left
+            pending_.store(0, std::memory_order_relaxed);
         %>
 
         if (get(chain.cnt)) {
@@ -97,6 +106,7 @@ namespace condvar_chained_queue
           if (scope == VALID) {
             send = queue_.is_empty();
             queue_.insert(chain);
+            pending_.fetch_add(1, std::memory_order_release);
             set(errn) = 0;
           }
         %>
@@ -112,6 +122,8 @@ namespace condvar_chained_queue
         <% auto scope = lock2_.make_locked_scope(err);
           send = queue_.is_empty();
           queue_.insert(err, chain);
+          if (!err)
+            pending_.fetch_add(1, std::memory_order_release);
         %>
         if (send)
           cond_.signal(err);
@@ -130,11 +142,13 @@ namespace condvar_chained_queue
     }
 
   private:
-    t_validity   valid_ = INVALID;
-    t_queue      queue_;
-    t_cond_var   cond_;
-    t_mutex_lock lock1_;
-    t_mutex_lock lock2_;
+    const t_spin      spin_;
+    t_validity        valid_ = INVALID;
+    t_queue           queue_;
+    t_cond_var        cond_;
+    t_mutex_lock      lock1_;
+    t_mutex_lock      lock2_;
+    std::atomic<t_n_> pending_{0}; // chains inserted, guarded by lock2_
   };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -184,9 +198,9 @@ namespace condvar_chained_queue
 
 ///////////////////////////////////////////////////////////////////////////////
 
-  t_processor::t_processor(t_err err, t_n max) noexcept {
+  t_processor::t_processor(t_err err, t_n max, t_spin spin) noexcept {
     ERR_GUARD(err) {
-      impl_ = new t_impl_(err, max);
+      impl_ = new t_impl_(err, max, spin);
       if (impl_ == VALID) {
         if (err)
           impl_.clear();
@@ -54,6 +54,11 @@ namespace condvar_chained_queue
   using t_any   = container::any::t_any;
   using t_chain = container::chained_queue::t_chain<t_any>;
 
+  // nanoseconds the consumer polls for work before it waits on the condvar.
+  enum  t_spin_tag_ { };
+  using t_spin_ = named::t_uint64;
+  using t_spin  = named::t_explicit<t_spin_, t_spin_tag_>;
+
   /////////////////////////////////////////////////////////////////////////////
 
   class t_impl_;
@@ -117,8 +122,8 @@ namespace condvar_chained_queue
 
     using r_logic = t_logic&;
 
-     t_processor(t_err, t_n max) noexcept;
-     t_processor(x_processor)    noexcept;
+     t_processor(t_err, t_n max, t_spin = t_spin{0}) noexcept;
+     t_processor(x_processor)                        noexcept;
     ~t_processor();
 
     t_processor(R_processor)            = delete;
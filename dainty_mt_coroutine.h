@@ -0,0 +1,393 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+#ifndef _DAINTY_MT_COROUTINE_H_
+#define _DAINTY_MT_COROUTINE_H_
+
+// description
+// awaitables that suspend a coroutine until a processor, command or queue
+// can make progress, and continue it on the thread that runs the
+// event_dispatcher loop. a t_scheduler collects the coroutines that may go
+// on. the t_dispatcher::t_logic calls resume from notify_events_processed
+// and notify_timeout.
+//
+// fd based awaitables register the fd exposed by get_fd for one event.
+// acquire parks with a chained_queue t_wakeup. the release of a slot writes
+// the eventfd of the scheduler, that stays registered with the dispatcher,
+// and resume retries every parked acquire.
+//
+// only available when the compiler supports coroutines (C++20).
+
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+
+#include <vector>
+#include <algorithm>
+#include <coroutine>
+#include "dainty_os_fdbased.h"
+#include "dainty_mt_event_dispatcher.h"
+#include "dainty_mt_event.h"
+#include "dainty_mt_command.h"
+#include "dainty_mt_chained_queue.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace coroutine
+{
+  using named::t_n;
+  using named::t_n_;
+  using named::t_fd;
+  using named::t_void;
+  using named::t_bool;
+  using named::t_errn;
+  using named::P_cstr;
+  using named::VALID;
+  using named::t_prefix;
+  using err::t_err;
+  using event_dispatcher::r_dispatcher;
+  using event_dispatcher::t_event_logic;
+  using event_dispatcher::t_event_params;
+  using event_dispatcher::r_event_params;
+  using event_dispatcher::t_action;
+  using event_dispatcher::t_name;
+  using event_dispatcher::t_id;
+  using event_dispatcher::CONTINUE;
+  using event_dispatcher::REMOVE_EVENT;
+  using event_dispatcher::RD;
+
+  using t_handle = std::coroutine_handle<>;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_retry_ {
+  public:
+    virtual ~t_retry_() { }
+    virtual t_bool retry() noexcept = 0;
+
+    t_handle handle;
+  };
+  using p_retry_ = t_prefix<t_retry_>::p_;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_scheduler;
+  using r_scheduler = t_prefix<t_scheduler>::r_;
+
+  class t_scheduler : public t_event_logic {
+  public:
+    t_scheduler(t_err err, r_dispatcher dispatcher) noexcept
+      : dispatcher_(dispatcher), eventfd_(err, t_n{0}) {
+    }
+
+    ~t_scheduler() {
+      if (registered_)
+        dispatcher_.del_event(id_);
+    }
+
+    t_scheduler(const t_scheduler&)            = delete;
+    t_scheduler& operator=(const t_scheduler&) = delete;
+
+    r_dispatcher get_dispatcher() noexcept {
+      return dispatcher_;
+    }
+
+    // continue every coroutine whose fd fired or whose retry succeeds.
+    t_n resume() noexcept {
+      resuming_.swap(ready_);
+      for (t_n_ ix = 0; ix < parked_.size(); ) {
+        if (parked_[ix]->retry()) {
+          resuming_.push_back(parked_[ix]->handle);
+          parked_[ix] = parked_.back();
+          parked_.pop_back();
+        } else
+          ++ix;
+      }
+      const t_n n{resuming_.size()};
+      for (auto handle : resuming_)
+        handle.resume(); // may suspend again, on ready_ or parked_
+      resuming_.clear();
+      return n;
+    }
+
+    t_name get_name() const override {
+      return t_name{P_cstr{"coroutine scheduler"}};
+    }
+
+    // a parked acquire was woken, resume retries it.
+    t_action notify_event(r_event_params) override {
+      os::fdbased::t_eventfd::t_value value = 0;
+      eventfd_.read(value);
+      return t_action{CONTINUE};
+    }
+
+  private:
+    friend class t_readable;
+    friend class t_acquire_awaiter;
+
+    t_bool park_(p_retry_ retry) noexcept {
+      if (!registered_) {
+        t_err err;
+        id_ = dispatcher_.add_event(err, t_event_params{eventfd_.get_fd(), RD},
+                                    this);
+        if (err) {
+          err.clear();
+          return false;
+        }
+        registered_ = true;
+      }
+      parked_.push_back(retry);
+      return true;
+    }
+
+    t_void unpark_(p_retry_ retry) noexcept {
+      parked_.erase(std::remove(parked_.begin(), parked_.end(), retry),
+                    parked_.end());
+    }
+
+    // called from the thread that releases the slot.
+    t_void wake_() noexcept {
+      os::fdbased::t_eventfd::t_value value = 1;
+      eventfd_.write(value);
+    }
+
+    r_dispatcher           dispatcher_;
+    os::fdbased::t_eventfd eventfd_;
+    t_id                   id_ = t_id{0};
+    t_bool                 registered_ = false;
+    std::vector<t_handle>  ready_;
+    std::vector<t_handle>  resuming_;
+    std::vector<p_retry_>  parked_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // co_await readable(scheduler, fd) -> t_errn
+  class t_readable : public t_event_logic {
+  public:
+    t_readable(r_scheduler scheduler, t_fd fd) noexcept
+      : scheduler_(scheduler), fd_(fd) {
+    }
+
+    t_bool await_ready() noexcept {
+      return false;
+    }
+
+    t_bool await_suspend(t_handle handle) noexcept {
+      handle_ = handle;
+      t_err err;
+      scheduler_.get_dispatcher().add_event(err, t_event_params{fd_, RD},
+                                            this);
+      if (err) {
+        err.clear();
+        set(errn_) = -1;
+        return false;
+      }
+      return true;
+    }
+
+    t_errn await_resume() noexcept {
+      return errn_;
+    }
+
+    t_name get_name() const override {
+      return t_name{P_cstr{"coroutine"}};
+    }
+
+    t_action notify_event(r_event_params) override {
+      scheduler_.ready_.push_back(handle_);
+      return t_action{REMOVE_EVENT};
+    }
+
+  protected:
+    r_scheduler scheduler_;
+    t_fd        fd_;
+    t_handle    handle_;
+    t_errn      errn_{0};
+  };
+
+  inline t_readable readable(r_scheduler scheduler, t_fd fd) noexcept {
+    return {scheduler, fd};
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // co_await wait_event(scheduler, processor) -> event::t_cnt
+  class t_event_awaiter : public t_readable {
+  public:
+    t_event_awaiter(r_scheduler scheduler,
+                    event::r_processor processor) noexcept
+      : t_readable(scheduler, processor.get_fd()), processor_(processor) {
+    }
+
+    event::t_cnt await_resume() noexcept {
+      t_logic_ logic;
+      if (errn_ == VALID) {
+        t_err err;
+        processor_.process(err, logic, t_n{1}); // the fd is readable
+        err.clear();
+      }
+      return logic.cnt;
+    }
+
+  private:
+    class t_logic_ : public event::t_processor::t_logic {
+    public:
+      t_void async_process(event::t_cnt _cnt) noexcept override {
+        cnt = _cnt;
+      }
+
+      event::t_cnt cnt = event::t_cnt{0};
+    };
+
+    event::r_processor processor_;
+  };
+
+  inline t_event_awaiter wait_event(r_scheduler scheduler,
+                                    event::r_processor processor) noexcept {
+    return {scheduler, processor};
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // co_await request(scheduler, client, completion, cmd) -> t_errn
+  //   -1 when the request could not be queued or the logic failed it.
+  //   the completion is reset afterwards.
+  class t_request_awaiter : public t_readable {
+  public:
+    t_request_awaiter(r_scheduler scheduler, command::r_client client,
+                      command::r_completion completion,
+                      command::r_command cmd) noexcept
+      : t_readable(scheduler, completion.get_fd()), client_(client),
+        completion_(completion), cmd_(cmd) {
+    }
+
+    t_bool await_ready() noexcept {
+      if (client_.request(completion_, cmd_) != VALID) {
+        set(errn_) = -1;
+        return true;
+      }
+      return completion_.is_done();
+    }
+
+    t_errn await_resume() noexcept {
+      if (errn_ == VALID && completion_.has_failed())
+        set(errn_) = -1;
+      completion_.reset();
+      return errn_;
+    }
+
+  private:
+    command::r_client     client_;
+    command::r_completion completion_;
+    command::r_command    cmd_;
+  };
+
+  inline t_request_awaiter request(r_scheduler scheduler,
+                                   command::r_client client,
+                                   command::r_completion completion,
+                                   command::r_command cmd) noexcept {
+    return {scheduler, client, completion, cmd};
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // co_await acquire(scheduler, client, n) -> chained_queue::t_chain
+  //   an empty chain when the wakeup could not be queued or registered.
+  class t_acquire_awaiter : public t_retry_, public chained_queue::t_wakeup {
+  public:
+    t_acquire_awaiter(r_scheduler scheduler, chained_queue::r_client client,
+                      t_n n) noexcept
+      : scheduler_(scheduler), client_(client), n_(n) {
+    }
+
+    ~t_acquire_awaiter() {
+      if (parked_) {
+        client_.cancel(*this);
+        scheduler_.unpark_(this);
+      }
+    }
+
+    t_bool await_ready() noexcept {
+      chain_ = client_.acquire(n_);
+      return get(chain_.cnt);
+    }
+
+    t_bool await_suspend(t_handle _handle) noexcept {
+      handle = _handle;
+      if (retry())
+        return false;
+      if (!scheduler_.park_(this)) {
+        client_.cancel(*this);
+        return false;
+      }
+      parked_ = true;
+      return true;
+    }
+
+    chained_queue::t_chain await_resume() noexcept {
+      parked_ = false;
+      return chain_;
+    }
+
+    // acquire or queue the wakeup again. an err gives up with an empty
+    // chain, rather than to wait for a wake that does not come.
+    t_bool retry() noexcept override {
+      t_err err;
+      chain_ = client_.acquire(err, *this, n_);
+      if (err) {
+        err.clear();
+        return true;
+      }
+      return get(chain_.cnt);
+    }
+
+    t_void wake() noexcept override {
+      scheduler_.wake_();
+    }
+
+  private:
+    r_scheduler             scheduler_;
+    chained_queue::r_client client_;
+    t_n                     n_;
+    chained_queue::t_chain  chain_;
+    t_bool                  parked_ = false;
+  };
+
+  inline t_acquire_awaiter acquire(r_scheduler scheduler,
+                                   chained_queue::r_client client,
+                                   t_n n = t_n{1}) noexcept {
+    return {scheduler, client, n};
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
+
+#endif
+
+#endif
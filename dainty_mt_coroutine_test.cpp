@@ -0,0 +1,136 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// a coroutine that awaits acquire while every slot is in flight is parked,
+// and resumed from the event loop once another thread processes the chain
+// that held the slot. nothing else fires in between.
+
+#include <thread>
+#include <chrono>
+#include <cassert>
+#include "dainty_mt_coroutine.h"
+
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::coroutine;
+
+namespace
+{
+  using named::t_n_;
+  using named::t_usec;
+  using event_dispatcher::t_dispatcher;
+  using event_dispatcher::t_quit;
+
+  struct t_task_ {
+    struct promise_type {
+      t_task_ get_return_object() noexcept { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      t_void return_void() noexcept { }
+      t_void unhandled_exception() noexcept { }
+    };
+  };
+
+  struct t_consumer_ : chained_queue::t_processor::t_logic {
+    t_n_ chains = 0;
+
+    t_void async_process(t_chain) noexcept override {
+      ++chains;
+    }
+  };
+
+  struct t_loop_ : t_dispatcher::t_logic {
+    t_loop_(r_scheduler _scheduler) : scheduler(_scheduler) { }
+
+    r_scheduler scheduler;
+    t_bool      done    = false;
+    t_n_        resumed = 0;
+
+    t_void may_reorder_events (r_event_infos) override { }
+    t_void notify_event_remove(r_event_info)  override { }
+    t_quit notify_timeout     (t_usec)        override { return true; }
+    t_quit notify_error       (t_errn)        override { return true; }
+
+    t_quit notify_events_processed() override {
+      resumed += get(scheduler.resume());
+      return done;
+    }
+  };
+
+  t_task_ wait_slot_(r_scheduler scheduler, chained_queue::r_client client,
+                     t_loop_& loop) {
+    chained_queue::t_chain chain = co_await acquire(scheduler, client);
+    assert(get(chain.cnt) == 1);
+    client.insert(chain);
+    loop.done = true;
+  }
+
+  t_void test_acquire_(chained_queue::t_mode mode) {
+    err::t_err                 err;
+    t_dispatcher               dispatcher{err, event_dispatcher::t_params{
+                                         t_n{4}, P_cstr("epoll_service")}};
+    t_scheduler                scheduler{err, dispatcher};
+    chained_queue::t_processor processor{err, t_n{1}, mode};
+    assert(!err && dispatcher == VALID && processor == VALID);
+
+    auto client = processor.make_client(err, chained_queue::t_user{1L});
+    auto chain  = client.acquire(err);
+    assert(!err && get(chain.cnt) == 1);
+
+    t_loop_ loop{scheduler};
+    wait_slot_(scheduler, client, loop);
+    assert(!loop.done);
+
+    t_consumer_ consumer;
+    std::thread thread{[&]() {
+      err::t_err err;
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      client.insert(err, chain);
+      processor.process(err, consumer);
+      assert(!err);
+    }};
+    dispatcher.event_loop(err, &loop, t_usec{5000000});
+    thread.join();
+    assert(!err && loop.done && loop.resumed == 1 && consumer.chains == 1);
+  }
+}
+
+int main() {
+  test_acquire_(chained_queue::MUTEX_MODE);
+  test_acquire_(chained_queue::LOCKFREE_MODE);
+  return 0;
+}
+
+#else
+
+int main() {
+  return 0;
+}
+
+#endif
@@ -0,0 +1,667 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+
+#include <cerrno>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "dainty_named_utility.h"
+#include "dainty_os_threading.h"
+#include "dainty_mt_thread.h"
+#include "dainty_mt_command.h"
+#include "dainty_mt_dispatcher_pool.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace dispatcher_pool
+{
+  using named::t_n_;
+  using named::t_ix_;
+  using named::t_bool;
+  using named::p_void;
+  using named::t_uint64;
+  using named::P_cstr;
+  using err::r_err;
+  using event_dispatcher::t_dispatcher;
+  using event_dispatcher::t_action;
+  using event_dispatcher::t_timer_id;
+  using event_dispatcher::r_event_params;
+  using event_dispatcher::r_event_info;
+  using event_dispatcher::r_event_infos;
+  using event_dispatcher::t_usec;
+  using event_dispatcher::t_quit;
+  using event_dispatcher::t_name;
+  using event_dispatcher::t_id;
+  using event_dispatcher::CONTINUE;
+  using event_dispatcher::REMOVE_EVENT;
+  using event_dispatcher::QUIT_EVENT_LOOP;
+  using t_mutex_lock_ = os::threading::t_mutex_lock;
+  using t_clock_      = std::chrono::steady_clock;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  namespace
+  {
+    t_uint64 now_ns_() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               t_clock_::now().time_since_epoch()).count();
+    }
+
+    enum t_cmd_id_ : command::t_id { ADD_CMD_, DEL_CMD_, QUIT_CMD_ };
+
+    struct t_add_cmd_ : command::t_command {
+      const t_event_params& params;
+      p_event_logic         logic;
+      t_id                  id = t_id{0};
+
+      t_add_cmd_(const t_event_params& _params, p_event_logic _logic)
+        : t_command{ADD_CMD_}, params(_params), logic(_logic) {
+      }
+    };
+
+    // hands back the params of the deleted event, for a migration. they
+    // are not assignable, so they are kept in a vector of at most one.
+    struct t_del_cmd_ : command::t_command {
+      t_id                        id;
+      std::vector<t_event_params> params;
+
+      t_del_cmd_(t_id _id) : t_command{DEL_CMD_}, id(_id) {
+      }
+    };
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_shard_;
+
+  // stands in for the event logic of the user, so that the pool knows
+  // when an event removes itself and how often it fires.
+  class t_proxy_ : public t_event_logic {
+  public:
+    t_bool                used  = false;
+    t_ix_                 shard = 0;
+    t_id                  id    = t_id{0}; // in the dispatcher of the shard
+    p_event_logic         logic = nullptr;
+    std::atomic<t_uint64> hits{0};
+    t_shard_*             owner = nullptr;
+
+    virtual t_name get_name() const override {
+      return logic->get_name();
+    }
+
+    virtual t_action notify_event(r_event_params params) override {
+      hits.store(hits.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+      return forward_(logic->notify_event(params));
+    }
+
+    virtual t_action notify_timer(t_timer_id timer,
+                                  r_event_params params) override {
+      return forward_(logic->notify_timer(timer, params));
+    }
+
+  private:
+    t_action forward_(t_action action);
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // the proxies of all shards. lock is never held while waiting on a shard.
+  struct t_table_ {
+    t_mutex_lock_         lock;
+    std::vector<t_proxy_> proxies;
+    std::vector<t_n_>     free;
+
+    t_table_(t_n_ max) : proxies(max) {
+      free.reserve(max);
+      for (t_n_ ix = max; ix; --ix)
+        free.push_back(ix - 1);
+    }
+
+    t_void release(t_proxy_&) noexcept;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_shard_ : public t_dispatcher::t_logic,
+                   public command::t_processor::t_logic {
+  public:
+    std::atomic<t_n_>     events{0};
+    std::atomic<t_uint64> busy{0};      // nsecs spent handling events
+    std::atomic<t_bool>   dead{false};  // its event loop ended by itself
+
+    t_shard_(r_err err, t_table_& table,
+             const event_dispatcher::t_params& params) noexcept
+      : table_(table), dispatcher_{err, control_params_(params)},
+        processor_{err, t_n{4}}, client_{processor_.make_client(err,
+                                                 command::t_user{0L})},
+        control_{*this} {
+      ERR_GUARD(err) {
+        dispatcher_.add_event(err, {processor_.get_fd(),
+                                    event_dispatcher::RD}, &control_);
+        if (!err)
+          thread_ = new thread::t_thread{err, P_cstr("dispatcher_pool"),
+                      thread::t_thread::t_logic_ptr{new t_runner_{*this}},
+                      thread::JOINABLE};
+        if (err) { // no shard thread to quit or join
+          delete thread_;
+          thread_ = nullptr;
+        }
+      }
+    }
+
+    ~t_shard_() {
+      if (thread_) {
+        err::t_err err;
+        command::t_command cmd{QUIT_CMD_};
+        client_.request(err, cmd);
+        if (!err)
+          thread_->join(err);
+        err.clear();
+        delete thread_;
+      }
+    }
+
+    t_id add(r_err err, R_event_params params, p_event_logic logic) {
+      if (dead.load()) {
+        err = err::E_XXX;
+        return t_id{0};
+      }
+      t_add_cmd_ cmd{params, logic};
+      client_.request(err, cmd);
+      if (!err && !get(cmd.id))
+        err = err::E_XXX;
+      return cmd.id;
+    }
+
+    t_void del(r_err err, t_id id, std::vector<t_event_params>* params) {
+      t_del_cmd_ cmd{id};
+      client_.request(err, cmd);
+      if (!err && params && !cmd.params.empty())
+        params->push_back(cmd.params.front());
+    }
+
+    // an event removed itself, on the thread of the shard.
+    t_void forget(t_proxy_& proxy) {
+      table_.release(proxy);
+    }
+
+///////////////////////////////////////////////////////////////////////////////
+
+    virtual t_void may_reorder_events(r_event_infos) override {
+      start_ = now_ns_();
+    }
+
+    virtual t_void notify_event_remove(r_event_info) override {
+    }
+
+    virtual t_quit notify_timeout(t_usec) override {
+      return false;
+    }
+
+    // an interrupted wait is retried, any other error ends the loop.
+    virtual t_quit notify_error(named::t_errn) override {
+      return errno != EINTR && errno != EAGAIN;
+    }
+
+    // the commands are handled once the batch is done. a del_event in the
+    // middle of it would leave the event in the batch, to run here while
+    // it may already be added to another shard.
+    virtual t_quit notify_events_processed() override {
+      busy.fetch_add(now_ns_() - start_, std::memory_order_relaxed);
+      if (named::utility::reset(commands_)) {
+        err::t_err err;
+        processor_.process(err, *this);
+        err.clear();
+      }
+      return quit_;
+    }
+
+///////////////////////////////////////////////////////////////////////////////
+
+    virtual t_void process(t_err err, command::t_user,
+                           command::r_command cmd) noexcept override {
+      ERR_GUARD(err) {
+        switch (cmd.id) {
+          case ADD_CMD_: {
+            // a failure shows as id 0, which the control event holds. the
+            // err of a request is not seen by the requester.
+            t_add_cmd_& add = static_cast<t_add_cmd_&>(cmd);
+            if (!dead.load())
+              add.id = dispatcher_.add_event(add.params, add.logic);
+          } break;
+          case DEL_CMD_: {
+            t_del_cmd_& del = static_cast<t_del_cmd_&>(cmd);
+            auto info = dispatcher_.get_event(del.id); // may be gone
+            if (info) {
+              del.params.push_back(info->params);
+              dispatcher_.del_event(err, del.id);
+            }
+          } break;
+          case QUIT_CMD_:
+            quit_ = true;
+            break;
+        }
+      }
+    }
+
+    virtual t_void async_process(command::t_user,
+                                 command::p_command) noexcept override {
+    }
+
+  private:
+    class t_control_ : public t_event_logic {
+    public:
+      t_control_(t_shard_& shard) : shard_(shard) {
+      }
+
+      virtual t_name get_name() const override {
+        return t_name{"dispatcher_pool"};
+      }
+
+      virtual t_action notify_event(r_event_params) override {
+        shard_.commands_ = true;
+        return t_action{CONTINUE};
+      }
+
+    private:
+      t_shard_& shard_;
+    };
+
+    class t_runner_ : public thread::t_thread::t_logic {
+    public:
+      t_runner_(t_shard_& shard) : shard_(shard) {
+      }
+
+      // when the loop ends without a quit command, the shard is dead but
+      // keeps answering commands, so that no call of the pool blocks on it.
+      virtual p_void run() noexcept override {
+        shard_.dispatcher_.event_loop(&shard_);
+        if (!shard_.quit_) {
+          shard_.dead.store(true);
+          while (!shard_.quit_) {
+            err::t_err err;
+            shard_.processor_.process(err, shard_);
+            err.clear();
+          }
+        }
+        return nullptr;
+      }
+
+    private:
+      t_shard_& shard_;
+    };
+
+    // one more event for the control event.
+    static event_dispatcher::t_params control_params_(
+        const event_dispatcher::t_params& params) {
+      event_dispatcher::t_params control{params};
+      control.max = t_n{get(params.max) + 1};
+      return control;
+    }
+
+    t_table_&            table_;
+    t_dispatcher         dispatcher_;
+    command::t_processor processor_;
+    command::t_client    client_;
+    t_control_           control_;
+    thread::t_thread*    thread_ = nullptr;
+    t_uint64             start_    = 0;
+    t_bool               quit_     = false;
+    t_bool               commands_ = false; // control event in this batch
+  };
+
+  t_void t_table_::release(t_proxy_& proxy) noexcept {
+    <% auto scope = lock.make_locked_scope();
+      if (proxy.used) {
+        proxy.used = false;
+        proxy.owner->events.fetch_sub(1);
+        free.push_back(&proxy - proxies.data());
+      }
+    %>
+  }
+
+  t_action t_proxy_::forward_(t_action action) {
+    if (action.next) {
+      logic       = action.next;
+      action.next = nullptr;
+    }
+    if (action.cmd == REMOVE_EVENT)
+      owner->forget(*this);
+    return action;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // ops_ serializes the calls of the pool, which wait on the shards.
+  class t_impl_ {
+  public:
+    t_impl_(r_err err, R_params params) noexcept
+      : saturation_(get(params.saturation)),
+        table_(get(params.shards)*get(params.dispatcher.max)),
+        mark_(now_ns_()) {
+      ERR_GUARD(err) {
+        if (!get(params.shards) || !get(params.dispatcher.max)) {
+          err = err::E_XXX;
+          return;
+        }
+        for (t_n_ ix = 0; !err && ix < get(params.shards); ++ix)
+          shards_.push_back(new t_shard_{err, table_, params.dispatcher});
+      }
+    }
+
+    ~t_impl_() {
+      for (auto shard : shards_)
+        delete shard;
+    }
+
+    t_n get_shards() const noexcept {
+      return t_n{shards_.size()};
+    }
+
+    t_n get_events(t_ix shard) const noexcept {
+      if (get(shard) < shards_.size())
+        return t_n{shards_[get(shard)]->events.load()};
+      return t_n{0};
+    }
+
+    t_ix get_shard(t_event_id id) noexcept {
+      <% auto scope = table_.lock.make_locked_scope();
+        const t_n_ ix = get(id) - 1;
+        if (ix < table_.proxies.size() && table_.proxies[ix].used)
+          return t_ix{table_.proxies[ix].shard};
+      %>
+      return t_ix{shards_.size()};
+    }
+
+    t_event_id add_event(r_err err, R_event_params params,
+                         p_event_logic logic) noexcept {
+      <% auto scope = ops_.make_locked_scope(err);
+        t_ix_ least = 0;
+        for (t_ix_ ix = 1; ix < shards_.size(); ++ix)
+          if (shards_[least]->dead.load() ||
+              (!shards_[ix]->dead.load() &&
+               shards_[ix]->events.load() < shards_[least]->events.load()))
+            least = ix;
+        return add_(err, least, params, logic);
+      %>
+      return t_event_id{0};
+    }
+
+    t_event_id add_event(r_err err, t_ix shard, R_event_params params,
+                         p_event_logic logic) noexcept {
+      <% auto scope = ops_.make_locked_scope(err);
+        if (get(shard) < shards_.size())
+          return add_(err, get(shard), params, logic);
+        err = err::E_XXX;
+      %>
+      return t_event_id{0};
+    }
+
+    t_void del_event(r_err err, t_event_id id) noexcept {
+      <% auto scope = ops_.make_locked_scope(err);
+        t_proxy_* proxy = find_(id);
+        if (proxy) {
+          proxy->owner->del(err, proxy->id, nullptr);
+          if (!err)
+            table_.release(*proxy);
+        } else
+          err = err::E_XXX;
+      %>
+    }
+
+    t_void migrate_event(r_err err, t_event_id id, t_ix shard) noexcept {
+      <% auto scope = ops_.make_locked_scope(err);
+        t_proxy_* proxy = find_(id);
+        if (proxy && get(shard) < shards_.size())
+          migrate_(err, *proxy, get(shard));
+        else
+          err = err::E_XXX;
+      %>
+    }
+
+    t_n rebalance(r_err err) noexcept {
+      t_n_ moved = 0;
+      <% auto scope = ops_.make_locked_scope(err);
+        const t_uint64 now    = now_ns_();
+        const t_uint64 window = now - mark_ ? now - mark_ : 1;
+        mark_ = now;
+
+        const t_n_ n = shards_.size();
+        std::vector<t_uint64> load(n);
+        t_ix_ hot = 0, cold = n; // a dead shard is never cold
+        for (t_ix_ ix = 0; ix < n; ++ix) {
+          load[ix] = shards_[ix]->busy.exchange(0)*100/window;
+          if (load[ix] > load[hot])
+            hot = ix;
+          if (!shards_[ix]->dead.load() &&
+              (cold == n || load[ix] < load[cold]))
+            cold = ix;
+        }
+        if (cold == n)
+          return t_n{0};
+
+        // hits of the window, per shard and of the hot events.
+        std::vector<t_uint64> hits(n, 0);
+        std::vector<std::pair<t_uint64, t_proxy_*>> hot_events;
+        <% auto scope = table_.lock.make_locked_scope();
+          for (auto& proxy : table_.proxies) {
+            const t_uint64 cnt = proxy.hits.exchange(0);
+            if (proxy.used) {
+              hits[proxy.shard] += cnt;
+              if (proxy.shard == hot)
+                hot_events.push_back({cnt, &proxy});
+            }
+          }
+        %>
+
+        if (hot == cold || load[hot] < saturation_ ||
+            hits[hot] <= hits[cold])
+          return t_n{0};
+
+        std::sort(hot_events.begin(), hot_events.end(),
+                  [](const std::pair<t_uint64, t_proxy_*>& lh,
+                     const std::pair<t_uint64, t_proxy_*>& rh) {
+                    return lh.first > rh.first; });
+
+        const t_uint64 excess = (hits[hot] - hits[cold])/2;
+        t_uint64       done   = 0;
+        for (auto& event : hot_events) {
+          if (done + event.first > excess || !event.first)
+            continue;
+          migrate_(err, *event.second, cold);
+          if (err)
+            break;
+          done += event.first;
+          ++moved;
+        }
+      %>
+      return t_n{moved};
+    }
+
+  private:
+    t_proxy_* find_(t_event_id id) noexcept {
+      <% auto scope = table_.lock.make_locked_scope();
+        const t_n_ ix = get(id) - 1;
+        if (ix < table_.proxies.size() && table_.proxies[ix].used)
+          return &table_.proxies[ix];
+      %>
+      return nullptr;
+    }
+
+    t_event_id add_(r_err err, t_ix_ shard, R_event_params params,
+                    p_event_logic logic) noexcept {
+      t_proxy_* proxy = nullptr;
+      <% auto scope = table_.lock.make_locked_scope();
+        if (!table_.free.empty()) {
+          proxy = &table_.proxies[table_.free.back()];
+          table_.free.pop_back();
+          proxy->logic = logic;
+          proxy->shard = shard;
+          proxy->owner = shards_[shard];
+          proxy->hits.store(0);
+          proxy->used  = true;
+          proxy->owner->events.fetch_add(1);
+        }
+      %>
+      if (!proxy) {
+        err = err::E_XXX;
+        return t_event_id{0};
+      }
+      proxy->id = proxy->owner->add(err, params, proxy);
+      if (err) {
+        table_.release(*proxy);
+        return t_event_id{0};
+      }
+      return t_event_id{
+        static_cast<t_n_>(proxy - table_.proxies.data()) + 1};
+    }
+
+    // the event is only on the source shard until it is deleted there. a
+    // readiness that came in between is reported again by a level or
+    // oneshot event and by an edge event on adding it.
+    t_void migrate_(r_err err, t_proxy_& proxy, t_ix_ shard) noexcept {
+      if (proxy.shard == shard)
+        return;
+      std::vector<t_event_params> params;
+      proxy.owner->del(err, proxy.id, &params);
+      if (!err && params.empty()) // it removed itself meanwhile
+        return;
+      if (!err) {
+        <% auto scope = table_.lock.make_locked_scope();
+          proxy.owner->events.fetch_sub(1);
+          proxy.shard = shard;
+          proxy.owner = shards_[shard];
+          proxy.owner->events.fetch_add(1);
+        %>
+        proxy.id = proxy.owner->add(err, params.front(), &proxy);
+        if (err)
+          table_.release(proxy);
+      }
+    }
+
+    const t_uint64          saturation_;
+    t_mutex_lock_           ops_;
+    t_table_                table_;
+    std::vector<t_shard_*>  shards_;
+    t_uint64                mark_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  t_pool::t_pool(t_err err, R_params params) noexcept {
+    ERR_GUARD(err) {
+      impl_ = new t_impl_(err, params);
+      if (err)
+        impl_.clear();
+    }
+  }
+
+  t_pool::t_pool(x_pool pool) noexcept : impl_{pool.impl_.release()} {
+  }
+
+  t_pool::~t_pool() {
+    impl_.clear();
+  }
+
+  t_pool::operator t_validity() const noexcept {
+    return impl_ == VALID ? VALID : INVALID;
+  }
+
+  t_n t_pool::get_shards() const noexcept {
+    if (impl_ == VALID)
+      return impl_->get_shards();
+    return t_n{0};
+  }
+
+  t_n t_pool::get_events(t_ix shard) const noexcept {
+    if (impl_ == VALID)
+      return impl_->get_events(shard);
+    return t_n{0};
+  }
+
+  t_ix t_pool::get_shard(t_event_id id) const noexcept {
+    if (impl_ == VALID)
+      return impl_->get_shard(id);
+    return t_ix{0};
+  }
+
+  t_event_id t_pool::add_event(t_err err, R_event_params params,
+                               p_event_logic logic) noexcept {
+    ERR_GUARD(err) {
+      if (impl_ == VALID)
+        return impl_->add_event(err, params, logic);
+      err = err::E_XXX;
+    }
+    return t_event_id{0};
+  }
+
+  t_event_id t_pool::add_event(t_err err, t_ix shard, R_event_params params,
+                               p_event_logic logic) noexcept {
+    ERR_GUARD(err) {
+      if (impl_ == VALID)
+        return impl_->add_event(err, shard, params, logic);
+      err = err::E_XXX;
+    }
+    return t_event_id{0};
+  }
+
+  t_void t_pool::del_event(t_err err, t_event_id id) noexcept {
+    ERR_GUARD(err) {
+      if (impl_ == VALID)
+        impl_->del_event(err, id);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_void t_pool::migrate_event(t_err err, t_event_id id,
+                               t_ix shard) noexcept {
+    ERR_GUARD(err) {
+      if (impl_ == VALID)
+        impl_->migrate_event(err, id, shard);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_n t_pool::rebalance(t_err err) noexcept {
+    ERR_GUARD(err) {
+      if (impl_ == VALID)
+        return impl_->rebalance(err);
+      err = err::E_XXX;
+    }
+    return t_n{0};
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
@@ -0,0 +1,146 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+
+#ifndef _DAINTY_MT_DISPATCHER_POOL_H_
+#define _DAINTY_MT_DISPATCHER_POOL_H_
+
+// description
+// dispatcher_pool runs an event_dispatcher on each of a number of threads,
+// called shards. add_event places an event on the shard with the fewest
+// events. an event can be migrated to another shard, and rebalance moves
+// hot events off a shard that is busy above a saturation level.
+//
+// the pool is driven from threads that are not its shards: every call
+// hands a command to the shard and waits for it. the event logic runs on
+// the shard that owns the event, never on two at once. event timers do not
+// move along with a migrated event. a shard whose event loop fails is dead:
+// adding events to it fails, its events can still be deleted or migrated.
+
+#include "dainty_named_ptr.h"
+#include "dainty_mt_err.h"
+#include "dainty_mt_event_dispatcher.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace dispatcher_pool
+{
+  using named::t_n;
+  using named::t_ix;
+  using named::t_void;
+  using named::t_validity;
+  using named::t_prefix;
+  using named::VALID;
+  using named::INVALID;
+  using err::t_err;
+
+  using event_dispatcher::t_event_params;
+  using event_dispatcher::R_event_params;
+  using event_dispatcher::t_event_logic;
+  using event_dispatcher::p_event_logic;
+
+  enum  t_event_id_tag_ { };
+  using t_event_id_ = named::t_n_;
+  using t_event_id  = named::t_explicit<t_event_id_, t_event_id_tag_>;
+
+  enum  t_percent_tag_ { };
+  using t_percent_ = named::t_n_;
+  using t_percent  = named::t_explicit<t_percent_, t_percent_tag_>;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_params {
+  public:
+    using t_dispatcher_params = event_dispatcher::t_params;
+
+    t_n                 shards;
+    t_dispatcher_params dispatcher; // of each shard
+    t_percent           saturation; // busy time that makes a shard hot
+
+    inline
+    t_params(t_n _shards, const t_dispatcher_params& _dispatcher,
+             t_percent _saturation = t_percent{90})
+      : shards(_shards), dispatcher(_dispatcher), saturation(_saturation) {
+    }
+  };
+  using R_params = named::t_prefix<t_params>::R_;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_impl_;
+  enum  t_impl_owner_tag_ { };
+  using t_impl_owner_ = named::ptr::t_ptr<t_impl_, t_impl_owner_tag_,
+                                          named::ptr::t_deleter>;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_pool;
+  using r_pool = t_prefix<t_pool>::r_;
+  using x_pool = t_prefix<t_pool>::x_;
+  using R_pool = t_prefix<t_pool>::R_;
+
+  class t_pool {
+  public:
+     t_pool(t_err, R_params) noexcept;
+     t_pool(x_pool)          noexcept;
+    ~t_pool();
+
+    t_pool(R_pool)           = delete;
+    r_pool operator=(x_pool) = delete;
+    r_pool operator=(R_pool) = delete;
+
+    operator t_validity() const noexcept;
+
+    t_n  get_shards()           const noexcept;
+    t_n  get_events(t_ix shard) const noexcept;
+    t_ix get_shard (t_event_id) const noexcept;
+
+    // on the shard with the fewest events, or on the given shard.
+    t_event_id add_event(t_err, R_event_params, p_event_logic) noexcept;
+    t_event_id add_event(t_err, t_ix shard, R_event_params,
+                         p_event_logic) noexcept;
+
+    t_void del_event    (t_err, t_event_id)             noexcept;
+    t_void migrate_event(t_err, t_event_id, t_ix shard) noexcept;
+
+    // call it periodically. if the busiest shard was busy for at least
+    // the saturation level since the last call, its hottest events move
+    // to the least busy shard until about half of the difference in
+    // events handled is moved. returns the number of events moved.
+    t_n rebalance(t_err) noexcept;
+
+  private:
+    t_impl_owner_ impl_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
+
+#endif
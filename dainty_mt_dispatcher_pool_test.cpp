@@ -0,0 +1,127 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// events spread over the shards, keep firing after a migration and leave
+// the pool when deleted. an add the shard refuses fails the request.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include "dainty_mt_dispatcher_pool.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::dispatcher_pool;
+
+namespace
+{
+  using named::t_n_;
+  using named::t_bool;
+  using named::P_cstr;
+  using event_dispatcher::t_fd;
+  using event_dispatcher::t_name;
+  using event_dispatcher::t_action;
+  using event_dispatcher::r_event_params;
+  using event_dispatcher::RD;
+  using event_dispatcher::CONTINUE;
+
+  struct t_reader_ : t_event_logic {
+    std::atomic<t_n_> calls{0};
+
+    t_name get_name() const override {
+      return t_name{"reader"};
+    }
+
+    t_action notify_event(r_event_params params) override {
+      char byte;
+      assert(::read(get(params.fd), &byte, 1) == 1);
+      calls.fetch_add(1);
+      return t_action{CONTINUE};
+    }
+  };
+
+  struct t_pipe_ {
+    int fds[2];
+
+     t_pipe_() { assert(!::pipe(fds)); }
+    ~t_pipe_() { ::close(fds[0]); ::close(fds[1]); }
+
+    t_void write() { assert(::write(fds[1], "x", 1) == 1); }
+  };
+
+  // the shards run on their own threads.
+  t_bool wait_calls_(const t_reader_& reader, t_n_ calls) {
+    for (t_n_ n = 0; n < 1000 && reader.calls.load() < calls; ++n)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return reader.calls.load() == calls;
+  }
+}
+
+int main() {
+  err::t_err err;
+  t_pool     pool{err, t_params{t_n{2}, {t_n{4}, P_cstr("epoll_service")}}};
+  assert(!err && pool == VALID && get(pool.get_shards()) == 2);
+
+  t_pipe_   pipes[2];
+  t_reader_ readers[2];
+  const t_event_id first  = pool.add_event(err, {t_fd{pipes[0].fds[0]}, RD},
+                                           &readers[0]);
+  const t_event_id second = pool.add_event(err, {t_fd{pipes[1].fds[0]}, RD},
+                                           &readers[1]);
+  assert(!err);
+  assert(get(pool.get_events(t_ix{0})) == 1);
+  assert(get(pool.get_events(t_ix{1})) == 1);
+
+  pipes[0].write();
+  assert(wait_calls_(readers[0], 1));
+
+  const t_ix to{get(pool.get_shard(first)) ? 0U : 1U};
+  pool.migrate_event(err, first, to);
+  assert(!err && get(pool.get_shard(first)) == get(to));
+  assert(get(pool.get_events(to)) == 2);
+  pipes[0].write();
+  assert(wait_calls_(readers[0], 2));
+
+  pool.del_event(err, second);
+  assert(!err && get(pool.get_events(t_ix{get(to) ? 0U : 1U})) == 0);
+  pipes[1].write();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  assert(readers[1].calls.load() == 0);
+
+  const int null = ::open("/dev/null", O_RDONLY); // epoll refuses it
+  t_reader_ refused;
+  pool.add_event(err, {t_fd{null}, RD}, &refused);
+  assert(err);
+  err.clear();
+  assert(get(pool.get_events(t_ix{0})) + get(pool.get_events(t_ix{1})) == 1);
+  ::close(null);
+
+  return 0;
+}
@@ -38,13 +38,14 @@ namespace err
 
     const t_def err_tbl_[] = {
       /* CATEGORY                 MESSAGE               NEXT CODE      */
-      { IGNORE, P_cstr{"mt: bad"},             E_XXX   },
-      { IGNORE, P_cstr{"mt::undefined"},       0       }
+      { IGNORE, P_cstr{"mt: bad"},             E_XXX     },
+      { IGNORE, P_cstr{"mt::undefined"},       E_TIMEOUT },
+      { IGNORE, P_cstr{"mt: timeout"},         0         }
     };
   }
 
   t_def err_what(t_id id) {
-    return err_tbl_[id <= E_XXX ? id : 0];
+    return err_tbl_[id <= E_TIMEOUT ? id : 0];
   }
 }
 }
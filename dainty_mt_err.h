@@ -36,7 +36,8 @@ namespace mt
 namespace err
 {
   enum t_err_codes {
-    E_XXX  = 1
+    E_XXX     = 1,
+    E_TIMEOUT = 2
   };
 
   oops::t_def err_what(oops::t_id);
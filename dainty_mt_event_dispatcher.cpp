@@ -24,6 +24,17 @@
 
 ******************************************************************************/
 
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 #include "dainty_os_fdbased.h"
 #include "dainty_container_list.h"
 #include "dainty_mt_event_dispatcher.h"
@@ -35,6 +46,9 @@ namespace mt
 namespace event_dispatcher
 {
   using named::t_n_;
+  using named::t_ix_;
+  using named::p_void;
+  using named::t_uint64;
   using named::P_cstr;
   using os::fdbased::t_epoll;
   using os::t_epoll_event;
@@ -43,6 +57,438 @@ namespace event_dispatcher
   using t_events = container::freelist::t_freelist<t_event_info>;
   using r_events = named::t_prefix<t_events>::r_;
 
+///////////////////////////////////////////////////////////////////////////////
+
+  namespace
+  {
+    inline t_bool is_edge_(t_event_mode mode) {
+      return mode == EDGE_MODE || mode == EDGE_ONESHOT_MODE;
+    }
+
+    inline t_bool is_oneshot_(t_event_mode mode) {
+      return mode == ONESHOT_MODE || mode == EDGE_ONESHOT_MODE;
+    }
+
+    // poll and epoll use the same bits for IN and OUT.
+    inline t_event_type ready_(named::t_uint32 mask, t_event_type type) {
+      const t_bool rd = mask & EPOLLIN, wr = mask & EPOLLOUT;
+      if (rd && wr)
+        return RD_WR;
+      if (rd)
+        return RD;
+      if (wr)
+        return WR;
+      return type; // error or hangup, the logic finds out on its fd
+    }
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // a hierarchical timing wheel of four levels with 64 slots each over a
+  // msec tick, which covers about 4.6 hours. longer timeouts are clamped.
+  // timers sit in intrusive lists, so start and stop are O(1). a tick
+  // visits one slot and a level is cascaded into the one below every 64
+  // ticks of it. a bitmap per level finds the nearest timer to wait for.
+  class t_wheel_ {
+  public:
+    using t_tick_ = named::t_uint64;
+    using t_ids_  = std::vector<t_timer_id>;
+
+    struct t_fired_ {
+      t_bool        bound = false;
+      t_id          event = t_id{0};
+      p_timer_logic logic = nullptr;
+      t_timer_user  user  = t_timer_user{0L};
+    };
+
+    t_wheel_(t_n max, t_n max_events)
+      : nodes_(get(max)), bound_(get(max_events), NIL_),
+        origin_(t_clock_::now()) {
+      free_.reserve(get(max));
+      fired_.reserve(get(max));
+      for (t_n_ ix = get(max); ix; --ix)
+        free_.push_back(ix - 1);
+      for (auto& level : heads_)
+        for (auto& head : level)
+          head = NIL_;
+    }
+
+    t_timer_id start(t_usec usec, p_timer_logic logic, t_timer_user user) {
+      if (!logic || free_.empty())
+        return t_timer_id{0};
+      const t_n_ ix = start_(usec);
+      nodes_[ix].logic = logic;
+      nodes_[ix].user  = user;
+      return id_(ix);
+    }
+
+    t_timer_id start(t_id event, t_usec usec) {
+      const t_n_ eix = get(event);
+      if (eix >= bound_.size() || free_.empty())
+        return t_timer_id{0};
+      const t_n_ ix = start_(usec);
+      t_node_& node = nodes_[ix];
+      node.bound = true;
+      node.event = event;
+      node.enext = bound_[eix];
+      if (node.enext != NIL_)
+        nodes_[node.enext].eprev = ix;
+      bound_[eix] = ix;
+      return id_(ix);
+    }
+
+    t_bool stop(t_timer_id id) {
+      const t_n_ ix = find_(id);
+      if (ix != NIL_) {
+        release_(ix);
+        return true;
+      }
+      return false;
+    }
+
+    t_void stop_all(t_id event) {
+      const t_n_ eix = get(event);
+      if (eix < bound_.size())
+        while (bound_[eix] != NIL_)
+          release_(bound_[eix]);
+    }
+
+    // stop a fired timer and hand out what is needed to report it. false
+    // if it was stopped meanwhile.
+    t_bool take(t_timer_id id, t_fired_& fired) {
+      const t_n_ ix = find_(id);
+      if (ix != NIL_) {
+        const t_node_& node = nodes_[ix];
+        fired.bound = node.bound;
+        fired.event = node.event;
+        fired.logic = node.logic;
+        fired.user  = node.user;
+        release_(ix);
+        return true;
+      }
+      return false;
+    }
+
+    // msecs until the nearest slot that holds timers or must be cascaded.
+    // rounded up, because epoll waits in msecs and would otherwise spin
+    // through the last one.
+    t_bool next_timeout(t_usec& usec) const {
+      if (!active_)
+        return false;
+      t_tick_ ticks = SLOTS_ - (now_ & MASK_);
+      if (occupied_[0]) {
+        const t_n_    from = (now_ + 1) & MASK_;
+        const t_tick_ bits = from ? (occupied_[0] >> from) |
+                                    (occupied_[0] << (SLOTS_ - from))
+                                  : occupied_[0];
+        const t_tick_ next = __builtin_ctzll(bits) + 1;
+        if (next < ticks || !(occupied_[1] | occupied_[2] | occupied_[3]))
+          ticks = next;
+      }
+      const t_tick_ at   = (now_ + ticks)*TICK_USEC_;
+      const t_tick_ now  = elapsed_();
+      const t_tick_ left = at > now ? at - now + TICK_USEC_ - 1 : 0;
+      usec = t_usec(left/TICK_USEC_*TICK_USEC_);
+      return true;
+    }
+
+    // advance to the current tick. the ids are only valid until the next
+    // call and must be taken one by one.
+    const t_ids_& expire() {
+      fired_.clear();
+      advance_(elapsed_()/TICK_USEC_);
+      return fired_;
+    }
+
+  private:
+    using t_clock_ = std::chrono::steady_clock;
+
+    static constexpr t_n_    LEVELS_    = 4;
+    static constexpr t_n_    BITS_      = 6;
+    static constexpr t_n_    SLOTS_     = t_n_{1} << BITS_;
+    static constexpr t_tick_ MASK_      = SLOTS_ - 1;
+    static constexpr t_tick_ RANGE_     = t_tick_{1} << (BITS_*LEVELS_);
+    static constexpr t_tick_ TICK_USEC_ = 1000;
+    static constexpr t_n_    NIL_       = ~t_n_{0};
+    static constexpr t_n_    FIRED_     = LEVELS_; // level while in fired_
+
+    struct t_node_ {
+      named::t_uint32 gen   = 1;
+      t_bool          used  = false;
+      t_bool          bound = false;
+      t_n_            level = 0;
+      t_tick_         expiry = 0;
+      t_n_            prev  = NIL_;
+      t_n_            next  = NIL_;
+      t_n_            eprev = NIL_; // among the timers of one event
+      t_n_            enext = NIL_;
+      t_id            event = t_id{0};
+      p_timer_logic   logic = nullptr;
+      t_timer_user    user  = t_timer_user{0L};
+    };
+
+    t_tick_ elapsed_() const {
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+               t_clock_::now() - origin_).count();
+    }
+
+    t_timer_id id_(t_n_ ix) const {
+      return t_timer_id((t_timer_id_{nodes_[ix].gen} << 32) | ix);
+    }
+
+    t_n_ find_(t_timer_id id) const {
+      const t_n_ ix = get(id) & 0xffffffff;
+      if (ix < nodes_.size() && nodes_[ix].used &&
+          nodes_[ix].gen == (get(id) >> 32))
+        return ix;
+      return NIL_;
+    }
+
+    t_n_ start_(t_usec usec) {
+      if (!active_)
+        now_ = elapsed_()/TICK_USEC_; // nothing to catch up with
+      const t_tick_ usecs = get(usec) > 0 ? get(usec) : 0;
+      t_tick_ expiry = (elapsed_() + usecs + TICK_USEC_ - 1)/TICK_USEC_;
+      if (expiry <= now_)
+        expiry = now_ + 1;
+
+      const t_n_ ix = free_.back();
+      free_.pop_back();
+      t_node_& node = nodes_[ix];
+      node.used   = true;
+      node.bound  = false;
+      node.expiry = expiry;
+      node.eprev  = node.enext = NIL_;
+      node.logic  = nullptr;
+      node.user   = t_timer_user{0L};
+      ++active_;
+      insert_(ix);
+      return ix;
+    }
+
+    t_void insert_(t_n_ ix) {
+      t_node_& node = nodes_[ix];
+      if (node.expiry - now_ >= RANGE_)
+        node.expiry = now_ + RANGE_ - 1;
+      const t_tick_ delta = node.expiry - now_;
+      t_n_ level = 0;
+      while (level + 1 < LEVELS_ && delta >> (BITS_*(level + 1)))
+        ++level;
+      const t_n_ slot = (node.expiry >> (BITS_*level)) & MASK_;
+      node.level = level;
+      node.prev  = NIL_;
+      node.next  = heads_[level][slot];
+      if (node.next != NIL_)
+        nodes_[node.next].prev = ix;
+      heads_[level][slot] = ix;
+      occupied_[level] |= t_tick_{1} << slot;
+    }
+
+    t_void unlink_(t_n_ ix) {
+      t_node_& node = nodes_[ix];
+      if (node.level == FIRED_)
+        return;
+      const t_n_ slot = (node.expiry >> (BITS_*node.level)) & MASK_;
+      if (node.prev != NIL_)
+        nodes_[node.prev].next = node.next;
+      else {
+        heads_[node.level][slot] = node.next;
+        if (node.next == NIL_)
+          occupied_[node.level] &= ~(t_tick_{1} << slot);
+      }
+      if (node.next != NIL_)
+        nodes_[node.next].prev = node.prev;
+    }
+
+    t_void release_(t_n_ ix) {
+      t_node_& node = nodes_[ix];
+      unlink_(ix);
+      if (node.bound) {
+        if (node.eprev != NIL_)
+          nodes_[node.eprev].enext = node.enext;
+        else
+          bound_[get(node.event)] = node.enext;
+        if (node.enext != NIL_)
+          nodes_[node.enext].eprev = node.eprev;
+      }
+      node.used = false;
+      ++node.gen;
+      free_.push_back(ix);
+      --active_;
+    }
+
+    t_void cascade_(t_n_ level) {
+      const t_n_ slot = (now_ >> (BITS_*level)) & MASK_;
+      if (!slot && level + 1 < LEVELS_)
+        cascade_(level + 1);
+      t_n_ ix = heads_[level][slot];
+      heads_[level][slot] = NIL_;
+      occupied_[level] &= ~(t_tick_{1} << slot);
+      while (ix != NIL_) {
+        const t_n_ next = nodes_[ix].next;
+        insert_(ix);
+        ix = next;
+      }
+    }
+
+    t_void advance_(t_tick_ to) {
+      while (now_ < to) {
+        if (!active_ || fired_.size() == active_) {
+          now_ = to;
+          break;
+        }
+        if (!occupied_[0]) { // skip to the next cascade
+          const t_tick_ last = now_ | MASK_;
+          if (last >= to) {
+            now_ = to;
+            break;
+          }
+          now_ = last;
+        }
+        ++now_;
+        if (!(now_ & MASK_))
+          cascade_(1);
+        const t_n_ slot = now_ & MASK_;
+        t_n_ ix = heads_[0][slot];
+        heads_[0][slot] = NIL_;
+        occupied_[0] &= ~(t_tick_{1} << slot);
+        for (; ix != NIL_; ix = nodes_[ix].next) {
+          nodes_[ix].level = FIRED_;
+          fired_.push_back(id_(ix));
+        }
+      }
+    }
+
+    std::vector<t_node_>    nodes_;
+    std::vector<t_n_>       free_;
+    std::vector<t_n_>       bound_; // first timer per event id
+    t_ids_                  fired_;
+    t_n_                    heads_[LEVELS_][SLOTS_];
+    t_tick_                 occupied_[LEVELS_] = { 0, 0, 0, 0 };
+    t_tick_                 now_    = 0;
+    t_n_                    active_ = 0;
+    t_clock_::time_point    origin_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  namespace
+  {
+    using t_counter_ = std::atomic<t_uint64>;
+
+    inline t_uint64 now_ns_() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline unsigned long long ull_(t_uint64 value) {
+      return value;
+    }
+
+    // only the loop writes the counters, a relaxed load and store will do.
+    inline t_void add_(t_counter_& counter, t_uint64 value) {
+      counter.store(counter.load(std::memory_order_relaxed) + value,
+                    std::memory_order_relaxed);
+    }
+
+    inline t_void max_(t_counter_& counter, t_uint64 value) {
+      if (value > counter.load(std::memory_order_relaxed))
+        counter.store(value, std::memory_order_relaxed);
+    }
+
+    inline t_uint64 load_(const t_counter_& counter) {
+      return counter.load(std::memory_order_relaxed);
+    }
+
+    inline t_n_ log2_(t_uint64 value) {
+      return value ? 63 - __builtin_clzll(value) : 0;
+    }
+  }
+
+  // live tells a reader on another thread whether the slot belongs to an
+  // event, so it never has to look at the events themselves.
+  struct t_event_counters_ {
+    std::atomic<t_bool> live{false};
+    t_counter_ cnt{0};
+    t_counter_ total{0};
+    t_counter_ max{0};
+    t_counter_ hist[EVENT_STATS_BUCKETS];
+
+    t_event_counters_() {
+      reset();
+      retire();
+    }
+
+    t_void reset() {
+      cnt.store(0, std::memory_order_relaxed);
+      total.store(0, std::memory_order_relaxed);
+      max.store(0, std::memory_order_relaxed);
+      for (auto& bucket : hist)
+        bucket.store(0, std::memory_order_relaxed);
+      live.store(true, std::memory_order_release);
+    }
+
+    t_void retire() {
+      live.store(false, std::memory_order_release);
+    }
+
+    t_void record(t_uint64 ns) {
+      add_(cnt, 1);
+      add_(total, ns);
+      max_(max, ns);
+      const t_n_ ix = log2_(ns);
+      add_(hist[ix < EVENT_STATS_BUCKETS ? ix : EVENT_STATS_BUCKETS - 1], 1);
+    }
+
+    t_bool read(t_event_stats& stats) const {
+      if (!live.load(std::memory_order_acquire))
+        return false;
+      stats.cnt      = load_(cnt);
+      stats.total_ns = load_(total);
+      stats.max_ns   = load_(max);
+      for (t_n_ ix = 0; ix < EVENT_STATS_BUCKETS; ++ix)
+        stats.hist[ix] = load_(hist[ix]);
+      return true;
+    }
+  };
+
+  struct t_loop_counters_ {
+    t_counter_ iterations{0};
+    t_counter_ events{0};
+    t_counter_ max_batch{0};
+    t_counter_ batch[BATCH_STATS_BUCKETS];
+    t_counter_ idle{0};
+    t_counter_ busy{0};
+
+    t_loop_counters_() {
+      for (auto& bucket : batch)
+        bucket.store(0, std::memory_order_relaxed);
+    }
+
+    t_void waited(t_uint64 ns, t_n_ n) {
+      add_(iterations, 1);
+      add_(events, n);
+      max_(max_batch, n);
+      const t_n_ ix = n ? log2_(n) + 1 : 0;
+      add_(batch[ix < BATCH_STATS_BUCKETS ? ix : BATCH_STATS_BUCKETS - 1], 1);
+      add_(idle, ns);
+    }
+
+    t_void handled(t_uint64 ns) {
+      add_(busy, ns);
+    }
+
+    t_void read(t_loop_stats& stats) const {
+      stats.iterations = load_(iterations);
+      stats.events     = load_(events);
+      stats.max_batch  = load_(max_batch);
+      for (t_n_ ix = 0; ix < BATCH_STATS_BUCKETS; ++ix)
+        stats.batch[ix] = load_(batch[ix]);
+      stats.idle_ns    = load_(idle);
+      stats.busy_ns    = load_(busy);
+    }
+  };
+
 ///////////////////////////////////////////////////////////////////////////////
 
   using p_logic = t_dispatcher::p_logic;
@@ -51,14 +497,19 @@ namespace event_dispatcher
   public:
     const t_params params;
 
-    t_impl_(R_params _params) : params(_params), events_{params.max} {
-      infos_.reserve(get(params.max));
+    t_impl_(R_params _params)
+      : params(_params), events_{params.max},
+        wheel_{params.max_timers, params.max},
+        stats_(params.stats ? get(params.max) : 0) {
+      reserve_();
     }
 
     t_impl_(r_err err, R_params _params)
-      : params(_params), events_{params.max} { // XXX - no real check
+      : params(_params), events_{params.max},
+        wheel_{params.max_timers, params.max},
+        stats_(params.stats ? get(params.max) : 0) { // XXX - no real check
       ERR_GUARD(err) {
-        infos_.reserve(get(params.max));
+        reserve_();
       }
     }
 
@@ -81,6 +532,9 @@ namespace event_dispatcher
     virtual t_errn wait_events(       r_events, r_event_infos, t_usec) = 0;
     virtual t_void wait_events(r_err, r_events, r_event_infos, t_usec) = 0;
 
+    // arm a oneshot event again once its logic is done with it.
+    virtual t_errn rearm_event(r_event_info) = 0;
+
 ///////////////////////////////////////////////////////////////////////////////
 
     t_bool fetch_events(r_ids ids) const {
@@ -101,16 +555,52 @@ namespace event_dispatcher
       return nullptr;
     }
 
+    t_bool get_event_stats(t_id id, t_event_stats& stats) const {
+      return get(id) < stats_.size() && stats_[get(id)].read(stats);
+    }
+
+    t_void get_events_stats(r_events_stats events) const {
+      events.clear();
+      t_event_id_stats entry;
+      for (t_n_ ix = 0; ix < stats_.size(); ++ix) {
+        if (stats_[ix].read(entry.stats)) {
+          entry.id = t_id{ix};
+          events.push_back(entry);
+        }
+      }
+    }
+
+    t_void get_loop_stats(t_loop_stats& stats) const {
+      loop_stats_.read(stats);
+    }
+
     t_void display() const {
-      // access events
+      t_loop_stats loop;
+      loop_stats_.read(loop);
+      const t_uint64 total = loop.idle_ns + loop.busy_ns;
+      std::printf("dispatcher: %llu iterations, %llu events, max batch %llu, "
+                  "busy %llu%%\n",
+                  ull_(loop.iterations), ull_(loop.events),
+                  ull_(loop.max_batch),
+                  ull_(total ? loop.busy_ns*100/total : 0));
+      t_events_stats events;
+      get_events_stats(events);
+      for (auto& event : events)
+        std::printf("  event %llu: %llu calls, avg %llu ns, max %llu ns\n",
+                    ull_(get(event.id)), ull_(event.stats.cnt),
+                    ull_(event.stats.cnt ? event.stats.total_ns/event.stats.cnt
+                                         : 0),
+                    ull_(event.stats.max_ns));
     }
 
     t_id add_event(R_event_params params, p_event_logic logic) {
       auto result = events_.insert({logic, params});
       if (result) {
         result.ptr->id = result.id;
-        if (add_event(*result.ptr) == VALID)
+        if (add_event(*result.ptr) == VALID) {
+          reset_stats_(result.id);
           return result.id;
+        }
         events_.erase(result.id);
       }
       return t_id{0};
@@ -121,8 +611,10 @@ namespace event_dispatcher
       if (result) {
         result.ptr->id = result.id;
         add_event(err, *result.ptr);
-        if (!err)
+        if (!err) {
+          reset_stats_(result.id);
           return result.id;
+        }
         events_.erase(result.id);
       }
       return t_id{0};
@@ -132,6 +624,8 @@ namespace event_dispatcher
       auto info = events_.get(id);
       if (info) {
         del_event(*info);
+        wheel_.stop_all(id);
+        retire_stats_(id);
         events_.erase(id);
       }
       return nullptr;
@@ -141,6 +635,8 @@ namespace event_dispatcher
       auto info = events_.get(err, id);
       if (info) {
         del_event(err, *info);
+        wheel_.stop_all(id);
+        retire_stats_(id);
         events_.erase(id);
       }
       return nullptr;
@@ -149,6 +645,8 @@ namespace event_dispatcher
     t_void clear_events() {
       events_.each([this](t_id, r_event_info& info) {
         del_event(info);
+        wheel_.stop_all(info.id);
+        retire_stats_(info.id);
       });
       events_.clear();
     }
@@ -156,6 +654,8 @@ namespace event_dispatcher
     t_void clear_events(r_err) {
       events_.each([this](t_id, r_event_info& info) { //XXX - do you need err?
         del_event(info); // XXX this version may be removed
+        wheel_.stop_all(info.id);
+        retire_stats_(info.id);
       });
       events_.clear();
     }
@@ -164,41 +664,107 @@ namespace event_dispatcher
 
     t_quit process_events(r_event_infos infos, p_logic logic) {
       if (!infos.empty()) {
+        const t_bool prio = params.prio_order == PRIO_ORDER;
+        if (prio)
+          sort_(infos, 0);
         logic->may_reorder_events(infos);
-        for (auto info : infos) {
-          t_action action = info->logic->notify_event(info->params);
-          switch (action.cmd) {
-            case CONTINUE: {
-              t_event_logic* next = action.next;
-              if (next)
-                info->logic = next;
-            } break;
-            case REMOVE_EVENT:
-              del_event(info->id);
-              break;
-            case QUIT_EVENT_LOOP:
+        t_uint64 stamp = stamp_();
+        if (prio && get(params.prio_drain)) {
+          if (drain_(infos, stamp))
+            return true;
+        } else {
+          for (auto info : infos)
+            if (handle_(*info, stamp))
               return true;
-          }
         }
         return logic->notify_events_processed();
       }
       return false;
     }
 
+    t_quit process_timers() {
+      t_quit quit = false;
+      for (auto id : wheel_.expire()) {
+        t_wheel_::t_fired_ fired;
+        if (wheel_.take(id, fired)) {
+          if (fired.bound) {
+            t_event_info* info = events_.get(fired.event);
+            if (info) {
+              t_action action = info->logic->notify_timer(id, info->params);
+              if (do_action_(*info, action))
+                quit = true;
+            }
+          } else if (fired.logic->notify_timer(id, fired.user))
+            quit = true;
+        }
+      }
+      return quit;
+    }
+
+///////////////////////////////////////////////////////////////////////////////
+
+    t_timer_id start_timer(t_usec usec, p_timer_logic logic,
+                           t_timer_user user) {
+      return wheel_.start(usec, logic, user);
+    }
+
+    t_timer_id start_timer(r_err err, t_usec usec, p_timer_logic logic,
+                           t_timer_user user) {
+      t_timer_id id = wheel_.start(usec, logic, user);
+      if (get(id))
+        return id;
+      err = err::E_XXX;
+      return id;
+    }
+
+    t_timer_id start_event_timer(t_id event, t_usec usec) {
+      if (events_.get(event))
+        return wheel_.start(event, usec);
+      return t_timer_id{0};
+    }
+
+    t_timer_id start_event_timer(r_err err, t_id event, t_usec usec) {
+      if (events_.get(err, event)) {
+        t_timer_id id = wheel_.start(event, usec);
+        if (get(id))
+          return id;
+        err = err::E_XXX;
+      }
+      return t_timer_id{0};
+    }
+
+    t_bool stop_timer(t_timer_id id) {
+      return wheel_.stop(id);
+    }
+
+    t_void stop_timer(r_err err, t_timer_id id) {
+      if (!wheel_.stop(id))
+        err = err::E_XXX;
+    }
+
 ///////////////////////////////////////////////////////////////////////////////
 
     t_n event_loop(p_logic logic) {
       t_n_ cnt = 0;
       t_quit quit = false;
       do {
-        auto errn = wait_events(events_, infos_);
+        t_uint64 stamp = stamp_();
+        t_usec usec{0};
+        const t_bool timed = wait_usec_(usec, false);
+        auto errn = timed ? wait_events(events_, infos_, usec)
+                          : wait_events(events_, infos_);
+        waited_(stamp, infos_.size());
+        remove_failed_(logic);
         if (errn == VALID) {
           if (!infos_.empty())
             quit = process_events(infos_, logic);
           else
-            quit = true;
+            quit = !timed;
+          if (!quit)
+            quit = process_timers();
         } else
           quit = logic->notify_error(errn);
+        handled_(stamp);
         infos_.clear();
         ++cnt;
       } while (!quit);
@@ -209,14 +775,25 @@ namespace event_dispatcher
       t_n_ cnt = 0;
       t_quit quit = false;
       do {
-        wait_events(err, events_, infos_);
+        t_uint64 stamp = stamp_();
+        t_usec usec{0};
+        const t_bool timed = wait_usec_(usec, false);
+        if (timed)
+          wait_events(err, events_, infos_, usec);
+        else
+          wait_events(err, events_, infos_);
+        waited_(stamp, infos_.size());
+        remove_failed_(logic);
         if (!err) {
           if (!infos_.empty())
             quit = process_events(infos_, logic);
           else
-            quit = true;
+            quit = !timed;
+          if (!quit)
+            quit = process_timers();
         } else
           quit = logic->notify_error(t_errn(err.id()));
+        handled_(stamp);
         infos_.clear();
         ++cnt;
       } while (!quit);
@@ -227,14 +804,22 @@ namespace event_dispatcher
       t_n_ cnt = 0;
       t_quit quit = false;
       do {
-        t_errn errn = wait_events(events_, infos_, usec);
+        t_uint64 stamp = stamp_();
+        t_usec wait = usec;
+        const t_bool timed = wait_usec_(wait, true);
+        t_errn errn = wait_events(events_, infos_, wait);
+        waited_(stamp, infos_.size());
+        remove_failed_(logic);
         if (errn == VALID) {
           if (!infos_.empty())
             quit = process_events(infos_, logic);
-          else
+          else if (!timed)
             quit = logic->notify_timeout(usec);
+          if (!quit)
+            quit = process_timers();
         } else
           quit = logic->notify_error(errn);
+        handled_(stamp);
         infos_.clear();
         ++cnt;
       } while (!quit);
@@ -245,23 +830,279 @@ namespace event_dispatcher
       t_n_ cnt = 0;
       t_quit quit = false;
       do {
-        wait_events(err, events_, infos_, usec);
+        t_uint64 stamp = stamp_();
+        t_usec wait = usec;
+        const t_bool timed = wait_usec_(wait, true);
+        wait_events(err, events_, infos_, wait);
+        waited_(stamp, infos_.size());
+        remove_failed_(logic);
         if (!err) {
           if (!infos_.empty())
             quit = process_events(infos_, logic);
-          else
+          else if (!timed)
             quit = logic->notify_timeout(usec);
+          if (!quit)
+            quit = process_timers();
+        } else
+          quit = logic->notify_error(t_errn(err.id()));
+        handled_(stamp);
+        infos_.clear();
+        ++cnt;
+      } while (!quit);
+      return t_n{cnt};
+    }
+
+    t_n busy_event_loop(p_logic logic, t_usec idle, p_poll_hook hook) {
+      t_n_ cnt = 0;
+      t_quit quit = false;
+      t_uint64 since = 0;
+      do {
+        t_uint64 stamp = stamp_();
+        t_errn errn;
+        if (is_idle_(since, idle)) {
+          t_usec usec{0};
+          errn = wait_usec_(usec, false) ? wait_events(events_, infos_, usec)
+                                         : wait_events(events_, infos_);
+        } else
+          errn = wait_events(events_, infos_, t_usec{0});
+        waited_(stamp, infos_.size());
+        remove_failed_(logic);
+        if (errn == VALID) {
+          t_bool busy = !infos_.empty();
+          if (busy)
+            quit = process_events(infos_, logic);
+          if (!quit)
+            quit = process_timers();
+          if (!quit && hook)
+            quit = hook->notify_poll(busy);
+          if (busy)
+            since = 0;
+        } else
+          quit = logic->notify_error(errn);
+        handled_(stamp);
+        infos_.clear();
+        ++cnt;
+      } while (!quit);
+      return t_n{cnt};
+    }
+
+    t_n busy_event_loop(r_err err, p_logic logic, t_usec idle,
+                        p_poll_hook hook) {
+      t_n_ cnt = 0;
+      t_quit quit = false;
+      t_uint64 since = 0;
+      do {
+        t_uint64 stamp = stamp_();
+        if (is_idle_(since, idle)) {
+          t_usec usec{0};
+          if (wait_usec_(usec, false))
+            wait_events(err, events_, infos_, usec);
+          else
+            wait_events(err, events_, infos_);
+        } else
+          wait_events(err, events_, infos_, t_usec{0});
+        waited_(stamp, infos_.size());
+        remove_failed_(logic);
+        if (!err) {
+          t_bool busy = !infos_.empty();
+          if (busy)
+            quit = process_events(infos_, logic);
+          if (!quit)
+            quit = process_timers();
+          if (!quit && hook)
+            quit = hook->notify_poll(busy);
+          if (busy)
+            since = 0;
         } else
           quit = logic->notify_error(t_errn(err.id()));
+        handled_(stamp);
         infos_.clear();
         ++cnt;
       } while (!quit);
       return t_n{cnt};
     }
 
+  protected:
+    // events whose deferred add or modify failed. they are removed as soon
+    // as the wait that flushed them returns, see remove_failed_.
+    std::vector<t_id> failed_;
+
   private:
-    t_events       events_;
-    t_event_infos  infos_;
+    // an event that failed to register is handed to notify_event_remove
+    // and removed, instead of failing the wait it was flushed by.
+    t_void remove_failed_(p_logic logic) {
+      while (!failed_.empty()) {
+        const t_id id = failed_.back();
+        failed_.pop_back();
+        t_event_info* info = events_.get(id);
+        if (info) {
+          logic->notify_event_remove(*info);
+          del_event(id);
+        }
+      }
+    }
+
+    // the clock is only read once a poll found nothing to do.
+    static t_bool is_idle_(t_uint64& since, t_usec idle) {
+      if (!since) {
+        since = now_ns_();
+        return false;
+      }
+      return now_ns_() - since >= static_cast<t_uint64>(get(idle))*1000;
+    }
+
+    // the room needed to drain without allocating, see drain_.
+    t_void reserve_() {
+      t_n_ room = get(params.max);
+      if (params.prio_order == PRIO_ORDER && get(params.prio_drain)) {
+        room *= 2;
+        polled_.reserve(get(params.max));
+        marks_.assign(get(params.max), 0);
+      }
+      infos_.reserve(room);
+      if (params.prio_order == PRIO_ORDER)
+        sorted_.reserve(room);
+      if (params.ctl == DEFERRED_CTL)
+        failed_.reserve(get(params.max));
+    }
+
+    t_quit handle_(r_event_info info, t_uint64& stamp) {
+      const t_id id = info.id;
+      if (do_action_(info, info.logic->notify_event(info.params)))
+        return true;
+      if (!stats_.empty()) { // the handler and what it asked for
+        const t_uint64 now = now_ns_();
+        stats_[get(id)].record(now - stamp);
+        stamp = now;
+      }
+      return false;
+    }
+
+    // stable counting sort of infos from ix on, by prio.
+    t_void sort_(r_event_infos infos, t_ix_ from) {
+      const t_n_ PRIOS = 256;
+      t_n_ offsets[PRIOS] = {};
+      for (t_ix_ ix = from; ix < infos.size(); ++ix)
+        ++offsets[infos[ix]->params.prio];
+      t_n_ sum = from;
+      for (t_n_ prio = 0; prio < PRIOS; ++prio) {
+        const t_n_ cnt = offsets[prio];
+        if (cnt == infos.size() - from)
+          return; // one prio only
+        offsets[prio] = sum;
+        sum += cnt;
+      }
+      sorted_.resize(infos.size());
+      for (t_ix_ ix = from; ix < infos.size(); ++ix)
+        sorted_[offsets[infos[ix]->params.prio]++] = infos[ix];
+      std::copy(sorted_.begin() + from, sorted_.end(), infos.begin() + from);
+    }
+
+    // handle the sorted infos one prio at a time and poll without waiting
+    // before the next one. events that became ready are added, if not yet
+    // pending, and sorted in with the rest. infos has room for twice max,
+    // so a poll is only made while another max fits.
+    t_quit drain_(r_event_infos infos, t_uint64& stamp) {
+      if (!++pass_) {
+        std::fill(marks_.begin(), marks_.end(), 0);
+        pass_ = 1;
+      }
+      for (auto info : infos)
+        marks_[get(info->id)] = pass_;
+
+      t_n_  polls = get(params.prio_drain);
+      t_ix_ ix    = 0;
+      while (ix < infos.size()) {
+        const t_event_prio prio = infos[ix]->params.prio;
+        for (; ix < infos.size() && infos[ix]->params.prio == prio; ++ix) {
+          marks_[get(infos[ix]->id)] = 0;
+          if (handle_(*infos[ix], stamp))
+            return true;
+        }
+        if (ix < infos.size() && polls &&
+            infos.size() + get(params.max) <= infos.capacity()) {
+          --polls;
+          polled_.clear();
+          if (wait_events(events_, polled_, t_usec{0}) == VALID) {
+            const t_n_ end = infos.size();
+            for (auto info : polled_)
+              if (marks_[get(info->id)] != pass_) {
+                marks_[get(info->id)] = pass_;
+                infos.push_back(info);
+              }
+            if (infos.size() > end)
+              sort_(infos, ix);
+          }
+          stamp = stamp_();
+        }
+      }
+      return false;
+    }
+
+    t_quit do_action_(r_event_info info, t_action action) {
+      switch (action.cmd) {
+        case CONTINUE: {
+          t_event_logic* next = action.next;
+          if (next)
+            info.logic = next;
+          if (is_oneshot_(info.params.mode))
+            rearm_event(info);
+        } break;
+        case REMOVE_EVENT:
+          del_event(info.id);
+          break;
+        case QUIT_EVENT_LOOP:
+          return true;
+      }
+      return false;
+    }
+
+    t_uint64 stamp_() const {
+      return params.stats ? now_ns_() : 0;
+    }
+
+    t_void waited_(t_uint64& stamp, t_n_ n) {
+      if (params.stats) {
+        const t_uint64 now = now_ns_();
+        loop_stats_.waited(now - stamp, n);
+        stamp = now;
+      }
+    }
+
+    t_void handled_(t_uint64 stamp) {
+      if (params.stats)
+        loop_stats_.handled(now_ns_() - stamp);
+    }
+
+    t_void reset_stats_(t_id id) {
+      if (get(id) < stats_.size())
+        stats_[get(id)].reset();
+    }
+
+    t_void retire_stats_(t_id id) {
+      if (get(id) < stats_.size())
+        stats_[get(id)].retire();
+    }
+
+    // shorten the wait to the nearest timer. true if it was shortened.
+    t_bool wait_usec_(t_usec& usec, t_bool limited) const {
+      t_usec timer{0};
+      if (wheel_.next_timeout(timer) && (!limited || timer < usec)) {
+        usec = timer;
+        return true;
+      }
+      return false;
+    }
+
+    t_events                        events_;
+    t_event_infos                   infos_;
+    t_wheel_                        wheel_;
+    std::vector<t_event_counters_>  stats_;
+    t_loop_counters_                loop_stats_;
+    t_event_infos                   sorted_;
+    t_event_infos                   polled_;
+    std::vector<named::t_uint32>    marks_; // pass an event is pending in
+    named::t_uint32                 pass_ = 0;
   };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -271,11 +1112,15 @@ namespace event_dispatcher
     t_epoll_impl_(R_params _params)
       : t_impl_{_params}, epoll_events_{new t_epoll_event[get(_params.max)]},
         epoll_{} {
+      reserve_();
     }
 
     t_epoll_impl_(r_err err, R_params _params)
       : t_impl_{_params}, epoll_events_{new t_epoll_event[get(_params.max)]},
         epoll_{err} {
+      ERR_GUARD(err) {
+        reserve_();
+      }
     }
 
     ~t_epoll_impl_() {
@@ -288,78 +1133,647 @@ namespace event_dispatcher
     }
 
     virtual t_errn add_event(r_event_info info) override {
+     if (!ctls_.empty())
+       return defer_(info.id, get(info.params.fd), mask_(info.params));
      t_epoll::t_event_data data;
      data.u32 = get(info.id);
-     return epoll_.add_event(info.params.fd,
-                             info.params.type == RD ? EPOLLIN : EPOLLOUT,
-                             data);
+     return epoll_.add_event(info.params.fd, mask_(info.params), data);
     }
 
     virtual t_void add_event(r_err err,  r_event_info info) override {
+     if (!ctls_.empty()) {
+       if (defer_(info.id, get(info.params.fd), mask_(info.params)) != VALID)
+         err = err::E_XXX;
+       return;
+     }
+     t_epoll::t_event_data data;
+     data.u32 = get(info.id);
+     epoll_.add_event(err, info.params.fd, mask_(info.params), data);
+    }
+
+    virtual t_errn rearm_event(r_event_info info) override {
+     if (!ctls_.empty())
+       return defer_(info.id, get(info.params.fd), mask_(info.params));
      t_epoll::t_event_data data;
      data.u32 = get(info.id);
-     epoll_.add_event(err, info.params.fd,
-                      info.params.type == RD ? EPOLLIN : EPOLLOUT, data);
+     return epoll_.mod_event(info.params.fd, mask_(info.params), data);
     }
 
     virtual t_errn del_event(r_event_info info) override {
+      if (!ctls_.empty())
+        return defer_(info.id, get(BAD_FD), 0);
       return epoll_.del_event(info.params.fd);
     }
 
     virtual t_void del_event(r_err err, r_event_info info) override {
+      if (!ctls_.empty()) {
+        if (defer_(info.id, get(BAD_FD), 0) != VALID)
+          err = err::E_XXX;
+        return;
+      }
       epoll_.del_event(err, info.params.fd);
     }
 
     virtual t_errn wait_events(r_events events, r_event_infos infos) override {
+      flush_();
       auto verify = epoll_.wait(epoll_events_, params.max);
-      if (verify == VALID) {
-        for (t_n_ cnt = 0; cnt < get(verify); ++cnt)
-          infos.push_back(events.get(t_id{epoll_events_[0].data.u32}));
-      }
+      if (verify == VALID)
+        fill_infos_(events, infos, get(verify));
       return verify.errn;
     }
 
     virtual t_void wait_events(r_err err, r_events events,
                                r_event_infos infos) override {
+      flush_();
       t_n_ n = get(epoll_.wait(err, epoll_events_, params.max));
-      if (!err) {
-        for (t_n_ cnt = 0; cnt < n; ++cnt)
-          infos.push_back(events.get(t_id{epoll_events_[0].data.u32}));
-      }
+      if (!err)
+        fill_infos_(events, infos, n);
     }
 
     virtual t_errn wait_events(r_events events, r_event_infos infos,
                                t_usec usec) override {
+      flush_();
       auto verify = epoll_.wait(epoll_events_, params.max, usec);
-      if (verify == VALID) {
-        for (t_n_ cnt = 0; cnt < get(verify); ++cnt)
-          infos.push_back(events.get(t_id{epoll_events_[0].data.u32}));
-      }
+      if (verify == VALID)
+        fill_infos_(events, infos, get(verify));
       return verify.errn;
     }
 
     virtual t_void wait_events(r_err err, r_events events,
                                r_event_infos infos, t_usec usec) override {
+      flush_();
       t_n_ n = get(epoll_.wait(err, epoll_events_, params.max, usec));
-      if (!err) {
-        for (t_n_ cnt = 0; cnt < n; ++cnt)
-          infos.push_back(events.get(t_id{epoll_events_[0].data.u32}));
+      if (!err)
+        fill_infos_(events, infos, n);
+    }
+
+  private:
+    using t_fd_ = named::t_fd_;
+
+    // per event id, what epoll has and what is wanted at the next flush.
+    struct t_ctl_ {
+      t_fd_  kernel_fd = get(BAD_FD);
+      t_fd_  fd        = get(BAD_FD);
+      int    mask      = 0;
+      t_bool dirty     = false;
+    };
+
+    struct t_del_ {
+      t_fd_  fd;
+      t_n_   ix;
+      t_bool done;
+    };
+
+    t_void reserve_() {
+      if (params.ctl == DEFERRED_CTL) {
+        ctls_.resize(get(params.max));
+        dirty_.reserve(get(params.max));
+        dels_.reserve(get(params.max));
+      }
+    }
+
+    t_errn defer_(t_id id, t_fd_ fd, int mask) {
+      const t_n_ ix = get(id);
+      if (ix >= ctls_.size())
+        return t_errn{-1};
+      if (!failed_.empty()) // a new request for the id supersedes it
+        failed_.erase(std::remove(failed_.begin(), failed_.end(), id),
+                      failed_.end());
+      t_ctl_& ctl = ctls_[ix];
+      ctl.fd   = fd;
+      ctl.mask = mask;
+      if (!ctl.dirty) {
+        ctl.dirty = true;
+        dirty_.push_back(ix);
+      }
+      return t_errn{0};
+    }
+
+    t_errn ctl_(int op, t_fd_ fd, int mask, t_n_ ix) {
+      t_epoll::t_event_data data;
+      data.u32 = ix;
+      return op == EPOLL_CTL_ADD ? epoll_.add_event(t_fd{fd}, mask, data)
+                                 : epoll_.mod_event(t_fd{fd}, mask, data);
+    }
+
+    // dels go first. an add of a fd that is being deleted takes over its
+    // registration with a modify. a modify of a fd epoll dropped on its
+    // close becomes an add, an add of a fd still there a modify. an event
+    // that still fails goes to failed_.
+    t_void flush_() {
+      if (dirty_.empty())
+        return;
+
+      dels_.clear();
+      for (auto ix : dirty_) {
+        t_ctl_& ctl = ctls_[ix];
+        if (ctl.kernel_fd != get(BAD_FD) && ctl.kernel_fd != ctl.fd) {
+          dels_.push_back({ctl.kernel_fd, ix, false});
+          ctl.kernel_fd = get(BAD_FD);
+        }
+      }
+      std::sort(dels_.begin(), dels_.end(),
+                [](const t_del_& lh, const t_del_& rh) {
+                  return lh.fd < rh.fd; });
+
+      for (auto ix : dirty_) {
+        t_ctl_& ctl = ctls_[ix];
+        ctl.dirty = false;
+        if (ctl.fd == get(BAD_FD))
+          continue;
+        int op = EPOLL_CTL_MOD;
+        if (ctl.kernel_fd != ctl.fd) {
+          auto del = std::lower_bound(dels_.begin(), dels_.end(), ctl.fd,
+                                      [](const t_del_& lh, t_fd_ fd) {
+                                        return lh.fd < fd; });
+          if (del != dels_.end() && del->fd == ctl.fd && !del->done)
+            del->done = true;
+          else
+            op = EPOLL_CTL_ADD;
+        }
+        if (ctl_(op, ctl.fd, ctl.mask, ix) != VALID) {
+          const int other = errno == ENOENT ? EPOLL_CTL_ADD :
+                            errno == EEXIST ? EPOLL_CTL_MOD : 0;
+          if (!other || other == op ||
+              ctl_(other, ctl.fd, ctl.mask, ix) != VALID) {
+            failed_.push_back(t_id{ix});
+            continue;
+          }
+        }
+        ctl.kernel_fd = ctl.fd;
+      }
+
+      for (auto& del : dels_)
+        if (!del.done)
+          epoll_.del_event(t_fd{del.fd}); // gone already if it was closed
+      dirty_.clear();
+    }
+
+    static int mask_(R_event_params params) {
+      int mask = params.type == RD ? EPOLLIN  :
+                 params.type == WR ? EPOLLOUT : EPOLLIN | EPOLLOUT;
+      if (is_edge_(params.mode))
+        mask |= EPOLLET;
+      if (is_oneshot_(params.mode))
+        mask |= EPOLLONESHOT;
+      return mask;
+    }
+
+    // infos is reserved for params.max events, so the resize never
+    // reallocates and the whole batch is mapped in one pass.
+    t_void fill_infos_(r_events events, r_event_infos infos, t_n_ n) {
+      const t_n_ base = infos.size();
+      infos.resize(base + n);
+      t_event_info** out = infos.data() + base;
+      for (t_n_ ix = 0; ix < n; ++ix) {
+        out[ix] = events.get(t_id{epoll_events_[ix].data.u32});
+        out[ix]->params.ready = ready_(epoll_events_[ix].events,
+                                       out[ix]->params.type);
+      }
+    }
+
+    t_epoll_event*       epoll_events_;
+    t_epoll              epoll_;
+    std::vector<t_ctl_>  ctls_; // DEFERRED_CTL only
+    std::vector<t_n_>    dirty_;
+    std::vector<t_del_>  dels_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  namespace
+  {
+    int uring_setup_(unsigned entries, io_uring_params* params) {
+      return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int uring_enter_(int fd, unsigned submit, unsigned complete,
+                     unsigned flags, p_void arg, std::size_t size) {
+      return static_cast<int>(::syscall(__NR_io_uring_enter, fd, submit,
+                                        complete, flags, arg, size));
+    }
+
+    // the backend needs IORING_FEAT_EXT_ARG (5.11) for timed waits.
+    t_bool uring_probe_(t_bool sqpoll) {
+      io_uring_params params;
+      std::memset(&params, 0, sizeof(params));
+      if (sqpoll)
+        params.flags = IORING_SETUP_SQPOLL;
+      int fd = uring_setup_(4, &params);
+      if (fd < 0)
+        return false;
+      ::close(fd);
+      return params.features & IORING_FEAT_EXT_ARG;
+    }
+  }
+
+  // a bare submission/completion ring pair.
+  class t_uring_ {
+  public:
+    t_uring_(t_n_ max, t_bool sqpoll) noexcept {
+      unsigned entries = 8;
+      while (entries < max)
+        entries <<= 1;
+
+      io_uring_params params;
+      std::memset(&params, 0, sizeof(params));
+      params.flags      = IORING_SETUP_CQSIZE;
+      params.cq_entries = 4*entries;
+      if (sqpoll) {
+        params.flags         |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 100; // msec before the kernel thread sleeps
+      }
+
+      fd_ = uring_setup_(entries, &params);
+      if (fd_ < 0 || !(params.features & IORING_FEAT_EXT_ARG))
+        return;
+      sqpoll_ = sqpoll;
+
+      sq_len_ = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+      cq_len_ = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+      single_ = params.features & IORING_FEAT_SINGLE_MMAP;
+      if (single_)
+        sq_len_ = cq_len_ = sq_len_ > cq_len_ ? sq_len_ : cq_len_;
+
+      sq_ptr_ = map_(sq_len_, IORING_OFF_SQ_RING);
+      cq_ptr_ = single_ ? sq_ptr_ : map_(cq_len_, IORING_OFF_CQ_RING);
+      sqes_len_ = params.sq_entries*sizeof(io_uring_sqe);
+      p_void sqes = map_(sqes_len_, IORING_OFF_SQES);
+      if (!sq_ptr_ || !cq_ptr_ || !sqes)
+        return;
+
+      char* sq    = static_cast<char*>(sq_ptr_);
+      sq_head_    = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+      sq_tail_    = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+      sq_flags_   = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+      sq_mask_    = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+      sq_entries_ = params.sq_entries;
+      sqes_       = static_cast<io_uring_sqe*>(sqes);
+      unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+      for (unsigned ix = 0; ix < sq_entries_; ++ix)
+        array[ix] = ix;
+      sqe_head_ = sqe_tail_ = *sq_tail_;
+
+      char* cq  = static_cast<char*>(cq_ptr_);
+      cq_head_  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+      cq_tail_  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+      cq_mask_  = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+      cqes_     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+      valid_ = VALID;
+    }
+
+    ~t_uring_() {
+      if (sqes_)
+        ::munmap(sqes_, sqes_len_);
+      if (cq_ptr_ && !single_)
+        ::munmap(cq_ptr_, cq_len_);
+      if (sq_ptr_)
+        ::munmap(sq_ptr_, sq_len_);
+      if (fd_ >= 0)
+        ::close(fd_);
+    }
+
+    t_uring_(const t_uring_&)            = delete;
+    t_uring_& operator=(const t_uring_&) = delete;
+
+    operator t_validity() const noexcept {
+      return valid_;
+    }
+
+    // the sqe is only handed to the kernel with the next enter.
+    io_uring_sqe* get_sqe() noexcept {
+      if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+          sq_entries_) {
+        enter(false, nullptr);
+        if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+            sq_entries_)
+          return nullptr;
       }
+      io_uring_sqe* sqe = &sqes_[sqe_tail_++ & sq_mask_];
+      std::memset(sqe, 0, sizeof(*sqe));
+      return sqe;
+    }
+
+    t_bool has_cqes() const noexcept {
+      return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    }
+
+    // submit everything queued and, if asked, wait for one completion, all
+    // in a single syscall. with SQPOLL the kernel thread picks up the
+    // submissions and the syscall is only needed to wait or to wake it.
+    t_errn enter(t_bool wait, const __kernel_timespec* ts) noexcept {
+      const unsigned submit = sqe_tail_ - sqe_head_;
+      __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+      sqe_head_ = sqe_tail_;
+
+      unsigned flags = 0;
+      if (sqpoll_) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) &
+            IORING_SQ_NEED_WAKEUP)
+          flags |= IORING_ENTER_SQ_WAKEUP;
+      } else if (!submit && !wait)
+        return t_errn{0};
+
+      io_uring_getevents_arg arg;
+      std::memset(&arg, 0, sizeof(arg));
+      arg.ts = reinterpret_cast<named::t_uint64>(ts);
+      if (wait)
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+      else if (!flags && sqpoll_)
+        return t_errn{0};
+
+      int ret = uring_enter_(fd_, sqpoll_ ? 0 : submit, wait ? 1 : 0, flags,
+                             wait ? &arg : nullptr, wait ? sizeof(arg) : 0);
+      return ret >= 0 || errno == ETIME ? t_errn{0} : t_errn{-1};
+    }
+
+    // hand completions to f until it accepted max of them.
+    template<typename F>
+    t_void reap(t_n_ max, F&& f) noexcept {
+      unsigned       head = *cq_head_;
+      const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      for (t_n_ n = 0; head != tail && n < max; ++head)
+        if (f(cqes_[head & cq_mask_]))
+          ++n;
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+  private:
+    p_void map_(std::size_t len, off_t off) noexcept {
+      p_void ptr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd_, off);
+      return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    t_validity    valid_      = INVALID;
+    int           fd_         = -1;
+    t_bool        sqpoll_     = false;
+    t_bool        single_     = false;
+    p_void        sq_ptr_     = nullptr;
+    p_void        cq_ptr_     = nullptr;
+    std::size_t   sq_len_     = 0;
+    std::size_t   cq_len_     = 0;
+    std::size_t   sqes_len_   = 0;
+    unsigned*     sq_head_    = nullptr;
+    unsigned*     sq_tail_    = nullptr;
+    unsigned*     sq_flags_   = nullptr;
+    unsigned      sq_mask_    = 0;
+    unsigned      sq_entries_ = 0;
+    io_uring_sqe* sqes_       = nullptr;
+    unsigned      sqe_head_   = 0;
+    unsigned      sqe_tail_   = 0;
+    unsigned*     cq_head_    = nullptr;
+    unsigned*     cq_tail_    = nullptr;
+    unsigned      cq_mask_    = 0;
+    io_uring_cqe* cqes_       = nullptr;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // every event is a poll request on the ring. a fired poll is re-armed in
+  // the same io_uring_enter that waits for the next batch, which keeps the
+  // level triggered behaviour of epoll_service without extra syscalls.
+  // add and del are queued and submitted with that enter as well.
+  //
+  // an edge triggered event is a multishot poll that stays armed and is
+  // only re-armed if the kernel ends it. a oneshot event is re-armed by
+  // rearm_event once its logic returned CONTINUE.
+  class t_uring_impl_ : public t_impl_ {
+  public:
+    t_uring_impl_(R_params _params, t_bool sqpoll)
+      : t_impl_{_params}, uring_{get(_params.max), sqpoll},
+        gens_(get(_params.max), 0), seen_(get(_params.max), 0),
+        pos_(get(_params.max), 0) {
+      rearm_.reserve(get(_params.max));
+    }
+
+    t_uring_impl_(r_err err, R_params _params, t_bool sqpoll)
+      : t_impl_{_params}, uring_{get(_params.max), sqpoll},
+        gens_(get(_params.max), 0), seen_(get(_params.max), 0),
+        pos_(get(_params.max), 0) {
+      ERR_GUARD(err) {
+        rearm_.reserve(get(_params.max));
+        if (uring_ != VALID)
+          err = err::E_XXX;
+      }
+    }
+
+    virtual operator t_validity() const override {
+      return t_impl_::operator t_validity() == VALID &&
+             uring_ == VALID ? VALID : INVALID;
+    }
+
+    virtual t_errn add_event(r_event_info info) override {
+      return arm_(info) ? t_errn{0} : t_errn{-1};
+    }
+
+    virtual t_void add_event(r_err err, r_event_info info) override {
+      if (!arm_(info))
+        err = err::E_XXX;
+    }
+
+    virtual t_errn del_event(r_event_info info) override {
+      return disarm_(info) ? t_errn{0} : t_errn{-1};
+    }
+
+    virtual t_errn rearm_event(r_event_info info) override {
+      return arm_(info) ? t_errn{0} : t_errn{-1};
+    }
+
+    virtual t_void del_event(r_err err, r_event_info info) override {
+      if (!disarm_(info))
+        err = err::E_XXX;
+    }
+
+    virtual t_errn wait_events(r_events events, r_event_infos infos) override {
+      return wait_(events, infos, nullptr);
+    }
+
+    virtual t_void wait_events(r_err err, r_events events,
+                               r_event_infos infos) override {
+      if (wait_(events, infos, nullptr) != VALID)
+        err = err::E_XXX;
+    }
+
+    virtual t_errn wait_events(r_events events, r_event_infos infos,
+                               t_usec usec) override {
+      __kernel_timespec ts = to_timespec_(usec);
+      return wait_(events, infos, &ts);
+    }
+
+    virtual t_void wait_events(r_err err, r_events events,
+                               r_event_infos infos, t_usec usec) override {
+      __kernel_timespec ts = to_timespec_(usec);
+      if (wait_(events, infos, &ts) != VALID)
+        err = err::E_XXX;
     }
 
   private:
-    t_epoll_event* epoll_events_;
-    t_epoll        epoll_;
+    using t_tag_ = named::t_uint64;
+    static constexpr t_tag_ IGNORE_ = ~t_tag_{0};
+
+    static __kernel_timespec to_timespec_(t_usec usec) noexcept {
+      __kernel_timespec ts;
+      ts.tv_sec  = get(usec) / 1000000;
+      ts.tv_nsec = (get(usec) % 1000000) * 1000;
+      return ts;
+    }
+
+    static t_bool is_multishot_(t_event_mode mode) noexcept {
+#ifdef IORING_POLL_ADD_MULTI
+      return is_edge_(mode) && !is_oneshot_(mode);
+#else
+      return false; // edge triggered falls back on re-arming
+#endif
+    }
+
+    // the generation tells completions of a deleted event apart from
+    // those of a new event that reuses its id.
+    t_tag_ tag_(t_n_ ix) const noexcept {
+      return (t_tag_{gens_[ix]} << 32) | ix;
+    }
+
+    t_bool arm_(const t_event_info& info) noexcept {
+      const t_n_ ix = get(info.id);
+      if (ix < gens_.size()) {
+        io_uring_sqe* sqe = uring_.get_sqe();
+        if (sqe) {
+          sqe->opcode        = IORING_OP_POLL_ADD;
+          sqe->fd            = get(info.params.fd);
+          sqe->poll32_events = info.params.type == RD ? POLLIN  :
+                               info.params.type == WR ? POLLOUT :
+                                                        POLLIN | POLLOUT;
+          sqe->user_data     = tag_(ix);
+#ifdef IORING_POLL_ADD_MULTI
+          if (is_multishot_(info.params.mode))
+            sqe->len = IORING_POLL_ADD_MULTI;
+#endif
+          return true;
+        }
+      }
+      return false;
+    }
+
+    t_bool disarm_(const t_event_info& info) noexcept {
+      const t_n_ ix = get(info.id);
+      if (ix < gens_.size()) {
+        io_uring_sqe* sqe = uring_.get_sqe();
+        if (sqe) {
+          sqe->opcode    = IORING_OP_POLL_REMOVE;
+          sqe->addr      = tag_(ix);
+          sqe->user_data = IGNORE_;
+          ++gens_[ix];
+          return true;
+        }
+      }
+      return false;
+    }
+
+    t_errn wait_(r_events events, r_event_infos infos,
+                 const __kernel_timespec* ts) noexcept {
+      for (auto tag : rearm_) {
+        const t_n_ ix = tag & 0xffffffff;
+        if ((tag >> 32) == gens_[ix]) {
+          P_event_info info = events.get(t_id{ix});
+          if (info)
+            arm_(*info);
+        }
+      }
+      rearm_.clear();
+
+      if (uring_.enter(!uring_.has_cqes(), ts) != VALID)
+        return t_errn{-1};
+
+      // a multishot poll may complete more than once per batch, the event
+      // is then reported once with the union of what fired.
+      if (!++batch_) {
+        std::fill(seen_.begin(), seen_.end(), 0);
+        batch_ = 1;
+      }
+
+      // infos is reserved for params.max events, see fill_infos_ of epoll.
+      const t_n_ base = infos.size();
+      t_n_       n    = 0;
+      infos.resize(base + get(params.max));
+      uring_.reap(get(params.max), [&](const io_uring_cqe& cqe) {
+        if (cqe.user_data == IGNORE_)
+          return false;
+        const t_n_ ix = cqe.user_data & 0xffffffff;
+        if (ix >= gens_.size() || (cqe.user_data >> 32) != gens_[ix])
+          return false;
+        t_event_info* info = events.get(t_id{ix});
+        if (!info)
+          return false;
+        // an interrupted poll did not fire, it is armed again. any other
+        // failed poll is reported as ready, the way epoll reports EPOLLERR,
+        // and the logic finds out on its fd.
+        if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+          rearm_.push_back(cqe.user_data);
+          return false;
+        }
+        const t_event_mode mode = info->params.mode;
+        if (!is_oneshot_(mode) &&
+            (!is_multishot_(mode) || !(cqe.flags & IORING_CQE_F_MORE)))
+          rearm_.push_back(cqe.user_data);
+        const t_event_type ready = ready_(cqe.res < 0 ? 0 : cqe.res,
+                                          info->params.type);
+        if (seen_[ix] == batch_) {
+          if (infos[base + pos_[ix]]->params.ready != ready)
+            infos[base + pos_[ix]]->params.ready = RD_WR;
+          return false;
+        }
+        seen_[ix] = batch_;
+        pos_[ix]  = n;
+        info->params.ready = ready;
+        infos[base + n++] = info;
+        return true;
+      });
+      infos.resize(base + n);
+      return t_errn{0};
+    }
+
+    t_uring_                       uring_;
+    std::vector<named::t_uint32>   gens_;
+    std::vector<named::t_uint32>   seen_; // batch an id was last reported in
+    std::vector<t_n_>              pos_;  // and where
+    named::t_uint32                batch_ = 0;
+    std::vector<t_tag_>            rearm_;
   };
 
 ///////////////////////////////////////////////////////////////////////////////
 
+  namespace
+  {
+    struct t_services_ {
+      t_n_   cnt = 0;
+      P_cstr names[3];
+
+      t_services_() {
+        names[cnt++] = P_cstr("epoll_service");
+        if (uring_probe_(false)) {
+          names[cnt++] = P_cstr("io_uring_service");
+          if (uring_probe_(true))
+            names[cnt++] = P_cstr("io_uring_sqpoll_service");
+        }
+      }
+    };
+
+    const t_services_& services_() {
+      static const t_services_ services;
+      return services;
+    }
+  }
+
   t_n get_supported_services() {
-     return t_n{1};
+     return t_n{services_().cnt};
   }
 
-  t_service_name get_supported_service(t_ix) {
-    return "epoll_service";
+  t_service_name get_supported_service(t_ix ix) {
+    if (get(ix) < services_().cnt)
+      return services_().names[get(ix)];
+    return "";
   }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -367,6 +1781,10 @@ namespace event_dispatcher
   t_dispatcher::t_dispatcher(R_params params) {
     if (params.service_name == P_cstr("epoll_service"))
       impl_ = new t_epoll_impl_(params);
+    else if (params.service_name == P_cstr("io_uring_service"))
+      impl_ = new t_uring_impl_(params, false);
+    else if (params.service_name == P_cstr("io_uring_sqpoll_service"))
+      impl_ = new t_uring_impl_(params, true);
     else if (params.service_name == P_cstr("select_service")) {
     }
   }
@@ -375,6 +1793,10 @@ namespace event_dispatcher
     ERR_GUARD(err) {
       if (params.service_name == P_cstr("epoll_service"))
         impl_ = new t_epoll_impl_(err, params);
+      else if (params.service_name == P_cstr("io_uring_service"))
+        impl_ = new t_uring_impl_(err, params, false);
+      else if (params.service_name == P_cstr("io_uring_sqpoll_service"))
+        impl_ = new t_uring_impl_(err, params, true);
       else if (params.service_name == P_cstr("select_service")) {
       } else
         err = err::E_XXX;
@@ -399,6 +1821,24 @@ namespace event_dispatcher
     return t_params{t_n{0}, ""};
   }
 
+  t_bool t_dispatcher::get_event_stats(t_id id, t_event_stats& stats) const {
+    if (*this == VALID)
+      return impl_->get_event_stats(id, stats);
+    return false;
+  }
+
+  t_void t_dispatcher::get_events_stats(r_events_stats events) const {
+    if (*this == VALID)
+      impl_->get_events_stats(events);
+    else
+      events.clear();
+  }
+
+  t_void t_dispatcher::get_loop_stats(t_loop_stats& stats) const {
+    if (*this == VALID)
+      impl_->get_loop_stats(stats);
+  }
+
   t_void t_dispatcher::display() const {
     if (*this == VALID)
       impl_->display();
@@ -500,6 +1940,72 @@ namespace event_dispatcher
     return t_n{0};
   }
 
+  t_timer_id t_dispatcher::start_timer(t_usec usec, p_timer_logic logic,
+                                       t_timer_user user) {
+    if (*this == VALID)
+      return impl_->start_timer(usec, logic, user);
+    return t_timer_id{0};
+  }
+
+  t_timer_id t_dispatcher::start_timer(t_err err, t_usec usec,
+                                       p_timer_logic logic,
+                                       t_timer_user user) {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->start_timer(err, usec, logic, user);
+      err = err::E_XXX;
+    }
+    return t_timer_id{0};
+  }
+
+  t_timer_id t_dispatcher::start_event_timer(t_id id, t_usec usec) {
+    if (*this == VALID)
+      return impl_->start_event_timer(id, usec);
+    return t_timer_id{0};
+  }
+
+  t_timer_id t_dispatcher::start_event_timer(t_err err, t_id id,
+                                             t_usec usec) {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->start_event_timer(err, id, usec);
+      err = err::E_XXX;
+    }
+    return t_timer_id{0};
+  }
+
+  t_bool t_dispatcher::stop_timer(t_timer_id id) {
+    if (*this == VALID)
+      return impl_->stop_timer(id);
+    return false;
+  }
+
+  t_void t_dispatcher::stop_timer(t_err err, t_timer_id id) {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->stop_timer(err, id);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_n t_dispatcher::busy_event_loop(p_logic logic, t_usec idle,
+                                    p_poll_hook hook) {
+    if (*this == VALID)
+      return impl_->busy_event_loop(logic, idle, hook);
+    return t_n{0};
+  }
+
+  t_n t_dispatcher::busy_event_loop(t_err err, p_logic logic, t_usec idle,
+                                    p_poll_hook hook) {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->busy_event_loop(err, logic, idle, hook);
+      err = err::E_XXX;
+    }
+    return t_n{0};
+  }
+
 ///////////////////////////////////////////////////////////////////////////////
 }
 }
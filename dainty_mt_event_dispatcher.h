@@ -73,9 +73,46 @@ namespace event_dispatcher
 
   using t_event_prio   = named::t_uchar;
   using t_quit         = named::t_bool;
-  enum  t_event_type { RD, WR };
+  enum  t_event_type { RD, WR, RD_WR };
   enum  t_cmd        { QUIT_EVENT_LOOP, REMOVE_EVENT, CONTINUE };
 
+  // NO_PRIO_ORDER: events are handled in the order they are reported.
+  // PRIO_ORDER:    ready events are handled by prio, 0 first, before
+  //                may_reorder_events sees them. with prio_drain the loop
+  //                polls again after each prio, up to prio_drain times per
+  //                wakeup, so that ready events of a higher prio overtake
+  //                the lower ones still pending. io_uring_sqpoll_service
+  //                re-arms on its kernel thread, so such a poll may not
+  //                yet see a level triggered event that is still ready.
+  enum  t_prio_order { NO_PRIO_ORDER, PRIO_ORDER };
+
+  // IMMEDIATE_CTL: add, del and re-arm reach epoll straight away.
+  // DEFERRED_CTL:  they are queued per event and applied just before the
+  //                next wait. an add and del in between cancel out, a del
+  //                and add of the same fd become a single modify. an add
+  //                or modify that then fails removes the event, which is
+  //                reported to notify_event_remove once that wait returns.
+  //                call del_event before the fd is closed. io_uring_service
+  //                always defers.
+  enum  t_ctl { IMMEDIATE_CTL, DEFERRED_CTL };
+
+  // LEVEL_MODE:        the event is reported as long as the fd is ready.
+  // EDGE_MODE:         the event is reported when the fd becomes ready.
+  //                    the logic must read or write until EAGAIN.
+  // ONESHOT_MODE:      the event is reported once and then disarmed until
+  //                    its logic returns CONTINUE, which re-arms it. the
+  //                    fd is never handled twice at the same time.
+  // EDGE_ONESHOT_MODE: both of the above.
+  enum  t_event_mode { LEVEL_MODE, EDGE_MODE, ONESHOT_MODE,
+                       EDGE_ONESHOT_MODE };
+
+  enum  t_timer_id_tag_ {};
+  using t_timer_id_ = named::t_uint64;
+  using t_timer_id  = named::t_explicit<t_timer_id_, t_timer_id_tag_>;
+
+  enum  t_timer_user_tag_ {};
+  using t_timer_user = named::t_user<t_timer_user_tag_>;
+
 ///////////////////////////////////////////////////////////////////////////////
 
   class t_impl_;
@@ -85,6 +122,8 @@ namespace event_dispatcher
 
 ///////////////////////////////////////////////////////////////////////////////
 
+  // "epoll_service" always, "io_uring_service" and
+  // "io_uring_sqpoll_service" when the running kernel supports them.
   t_n            get_supported_services();
   t_service_name get_supported_service (t_ix);
 
@@ -96,11 +135,15 @@ namespace event_dispatcher
     const t_event_type type;
     const t_event_prio prio;
           t_event_user user;
+    const t_event_mode mode;
+          t_event_type ready; // what fired, set before notify_event
 
     inline
     t_event_params(t_fd _fd, t_event_type _type, t_event_prio _prio = 0,
-                   t_event_user _user = t_event_user{0L})
-      : fd{_fd}, type(_type), prio(_prio), user(_user) {
+                   t_event_user _user = t_event_user{0L},
+                   t_event_mode _mode = LEVEL_MODE)
+      : fd{_fd}, type(_type), prio(_prio), user(_user), mode(_mode),
+        ready(_type) {
     }
   };
 
@@ -133,11 +176,31 @@ namespace event_dispatcher
     using t_name         = event_dispatcher::t_name;
     using r_event_params = event_dispatcher::r_event_params;
     using t_action       = event_dispatcher::t_action;
+    using t_timer_id     = event_dispatcher::t_timer_id;
 
     virtual ~t_event_logic() { }
     virtual t_name   get_name() const = 0;
     virtual t_action notify_event(r_event_params) = 0;
+
+    // an event timer of this event expired, see start_event_timer.
+    virtual t_action notify_timer(t_timer_id, r_event_params) {
+      return t_action{CONTINUE};
+    }
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // a timer fires once. start it again from notify_timer to repeat it.
+  class t_timer_logic {
+  public:
+    using t_timer_id   = event_dispatcher::t_timer_id;
+    using t_timer_user = event_dispatcher::t_timer_user;
+    using t_quit       = event_dispatcher::t_quit;
+
+    virtual ~t_timer_logic() { }
+    virtual t_quit notify_timer(t_timer_id, t_timer_user) = 0;
   };
+  using p_timer_logic = named::t_prefix<t_timer_logic>::p_;
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -158,15 +221,76 @@ namespace event_dispatcher
   using t_event_infos = std::vector<t_event_info*>;
   using r_event_infos = named::t_prefix<t_event_infos>::r_;
 
+///////////////////////////////////////////////////////////////////////////////
+
+  // called by busy_event_loop between its polls, to check sources that are
+  // not fds, e.g. lock-free queues. set busy if work was found.
+  class t_poll_hook {
+  public:
+    using t_bool = event_dispatcher::t_bool;
+    using t_quit = event_dispatcher::t_quit;
+
+    virtual ~t_poll_hook() { }
+    virtual t_quit notify_poll(t_bool& busy) = 0;
+  };
+  using p_poll_hook = named::t_prefix<t_poll_hook>::p_;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // what the loop measured, in nsecs. hist bucket ix counts handler times
+  // in [2^ix, 2^(ix+1)), batch bucket 0 counts waits without events and
+  // bucket ix those with [2^(ix-1), 2^ix) events. the last bucket takes all
+  // above. iterations over idle_ns + busy_ns gives the iteration rate.
+  const named::t_n_ EVENT_STATS_BUCKETS = 32;
+  const named::t_n_ BATCH_STATS_BUCKETS = 16;
+
+  using t_stat = named::t_uint64;
+
+  class t_event_stats {
+  public:
+    t_stat cnt      = 0;
+    t_stat total_ns = 0;
+    t_stat max_ns   = 0;
+    t_stat hist[EVENT_STATS_BUCKETS] = {};
+  };
+
+  class t_event_id_stats {
+  public:
+    t_id          id = t_id{0};
+    t_event_stats stats;
+  };
+  using t_events_stats = std::vector<t_event_id_stats>;
+  using r_events_stats = named::t_prefix<t_events_stats>::r_;
+
+  class t_loop_stats {
+  public:
+    t_stat iterations = 0;
+    t_stat events     = 0;
+    t_stat max_batch  = 0;
+    t_stat batch[BATCH_STATS_BUCKETS] = {};
+    t_stat idle_ns    = 0; // waiting for events
+    t_stat busy_ns    = 0; // handling events and timers
+  };
+
 ///////////////////////////////////////////////////////////////////////////////
 
   class t_params {
   public:
     t_n            max;
     t_service_name service_name;
+    t_n            max_timers;
+    t_bool         stats; // keep t_event_stats and t_loop_stats
+    t_prio_order   prio_order;
+    t_n            prio_drain;
+    t_ctl          ctl;
 
     inline
-    t_params(t_n _max, R_service_name _name) : max(_max), service_name(_name) {
+    t_params(t_n _max, R_service_name _name, t_n _max_timers = t_n{0},
+             t_bool _stats = false, t_prio_order _prio_order = NO_PRIO_ORDER,
+             t_n _prio_drain = t_n{0}, t_ctl _ctl = IMMEDIATE_CTL)
+      : max(_max), service_name(_name), max_timers(_max_timers),
+        stats(_stats), prio_order(_prio_order), prio_drain(_prio_drain),
+        ctl(_ctl) {
     }
   };
   using R_params = named::t_prefix<t_params>::R_;
@@ -211,7 +335,20 @@ namespace event_dispatcher
 
     operator t_validity() const;
     t_params get_params() const;
-    t_void   display   () const;
+
+    // with t_params::stats. the counters can be read from any thread while
+    // the loop runs; a snapshot is consistent per counter only. the stats
+    // of an event restart when its id is reused, and an id without an
+    // event has none. get_events_stats replaces its argument with the
+    // stats of every event that has them.
+    t_bool   get_event_stats (t_id, t_event_stats&) const;
+    t_void   get_events_stats(r_events_stats)       const;
+    t_void   get_loop_stats  (t_loop_stats&)        const;
+
+    // print the stats to stdout. it reads them as the getters do, so any
+    // thread may call it. events show by id, their names belong to the
+    // logic, which only the loop thread may call.
+    t_void   display() const;
 
     t_id          add_event(       R_event_params, p_event_logic);
     t_id          add_event(t_err, R_event_params, p_event_logic);
@@ -232,6 +369,26 @@ namespace event_dispatcher
     t_n event_loop(       p_logic, t_usec);
     t_n event_loop(t_err, p_logic, t_usec);
 
+    // poll for events without waiting, and call the hook after every poll,
+    // as long as there was something to do in the last idle usecs. then
+    // block like event_loop(p_logic) until an event or timer is due. what
+    // the hook checks must also be reachable by an event, e.g. the fd of
+    // a queue, or it is only seen once the loop wakes up.
+    t_n busy_event_loop(       p_logic, t_usec idle, p_poll_hook = nullptr);
+    t_n busy_event_loop(t_err, p_logic, t_usec idle, p_poll_hook = nullptr);
+
+    // timers expire on the event_loop thread, which waits no longer than
+    // the nearest one. the resolution is a msec. an event timer is reported
+    // to notify_timer of its event logic and is stopped with the event.
+    t_timer_id start_timer      (       t_usec, p_timer_logic,
+                                 t_timer_user = t_timer_user{0L});
+    t_timer_id start_timer      (t_err, t_usec, p_timer_logic,
+                                 t_timer_user = t_timer_user{0L});
+    t_timer_id start_event_timer(       t_id, t_usec);
+    t_timer_id start_event_timer(t_err, t_id, t_usec);
+    t_bool     stop_timer       (       t_timer_id);
+    t_void     stop_timer       (t_err, t_timer_id);
+
   private:
     t_impl_owner_ impl_;
   };
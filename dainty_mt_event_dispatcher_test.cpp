@@ -0,0 +1,501 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// events are reported by every supported service, io_uring reports a poll
+// that failed instead of dropping it, a deferred add that fails removes
+// its event without failing the wait, and event stats exist only for as
+// long as their event does, whether read per id or for all events. a
+// batch of ready events reaches every logic once. an edge triggered event
+// is only reported again when more data arrives, a oneshot event only
+// once its logic returned CONTINUE, and RD_WR reports what is ready.
+// timers expire in order, no earlier than asked and through the timer
+// wheel's upper level too, without spinning while they are due. a
+// stopped timer never fires and the timers of an event stop with it.
+// with PRIO_ORDER ready events are handled 0 first and prio_drain lets a
+// level triggered event that is still ready overtake a lower prio within
+// the same wakeup, except where a kernel thread re-arms it. every
+// service re-arms a level triggered event that stays ready.
+// busy_event_loop polls and calls its hook for as long as the hook finds
+// work, and blocks once it was idle for long enough.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cassert>
+#include <chrono>
+#include <vector>
+#include "dainty_mt_event_dispatcher.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::event_dispatcher;
+
+namespace
+{
+  using named::t_n_;
+  using named::t_ix;
+  using named::P_cstr;
+
+  using t_clock_ = std::chrono::steady_clock;
+
+  struct t_loop_ : t_dispatcher::t_logic {
+    t_n_ batches    = 0;
+    t_n_ removed    = 0;
+    t_n_ quit_after = 1;
+
+    t_void may_reorder_events (r_event_infos) override { }
+    t_void notify_event_remove(r_event_info)  override { ++removed; }
+    t_quit notify_timeout     (t_usec)        override { return true; }
+
+    // closing an io_uring, as an earlier test does, interrupts the next
+    // blocking wait of the thread once. waits that block use the non err
+    // event_loop, which then waits again.
+    t_quit notify_error(t_errn) override { return errno != EINTR; }
+
+    t_quit notify_events_processed() override {
+      return ++batches >= quit_after;
+    }
+  };
+
+  using t_order_ = std::vector<t_n_>;
+
+  struct t_reader_ : t_event_logic {
+    t_n_         calls  = 0;
+    t_n_         timers = 0;
+    t_event_type ready  = RD_WR;
+    t_order_*    order  = nullptr; // records the prio of every call
+    t_action     action{CONTINUE};
+
+    t_name get_name() const override {
+      return t_name{"reader"};
+    }
+
+    t_action notify_event(r_event_params params) override {
+      char byte;
+      if (::read(get(params.fd), &byte, 1) < 0)
+        action = t_action{REMOVE_EVENT};
+      ++calls;
+      ready = params.ready;
+      if (order)
+        order->push_back(params.prio);
+      return action;
+    }
+
+    t_action notify_timer(t_timer_id, r_event_params) override {
+      ++timers;
+      return t_action{REMOVE_EVENT};
+    }
+  };
+
+  // records which timers fired and how late, and quits after the last.
+  struct t_timers_ : t_timer_logic {
+    t_n_                 last  = 0;
+    std::vector<t_n_>    fired;
+    std::vector<t_n_>    msecs;
+    t_clock_::time_point start = t_clock_::now();
+
+    t_quit notify_timer(t_timer_id, t_timer_user user) override {
+      fired.push_back(user.id);
+      msecs.push_back(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        t_clock_::now() - start).count());
+      return fired.size() == last;
+    }
+  };
+
+  // counts the polls of busy_event_loop, and those made after the first
+  // late msecs, reports work while busy is set and quits at quit_at
+  // polls, if set.
+  struct t_hook_ : t_poll_hook {
+    t_n_                 polls   = 0;
+    t_n_                 quit_at = 0;
+    t_bool               busy    = false;
+    t_n_                 late    = 0;
+    t_n_                 lates   = 0;
+    t_clock_::time_point start   = t_clock_::now();
+
+    t_quit notify_poll(t_bool& _busy) override {
+      if (late && t_clock_::now() - start >= std::chrono::milliseconds(late))
+        ++lates;
+      if (busy)
+        _busy = true;
+      return ++polls == quit_at;
+    }
+  };
+
+  // a pipe with one byte in it, that is read without blocking.
+  struct t_pipe_ {
+    int fds[2];
+
+     t_pipe_() {
+      assert(!::pipe2(fds, O_NONBLOCK) && ::write(fds[1], "x", 1) == 1);
+    }
+    ~t_pipe_() { ::close(fds[0]); ::close(fds[1]); }
+
+    t_void add() { assert(::write(fds[1], "x", 1) == 1); }
+  };
+
+  t_void test_ready_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service}};
+    t_pipe_       pipe;
+    t_reader_     reader;
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    dispatcher.add_event(err, {t_fd{pipe.fds[0]}, RD}, &reader);
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && loop.batches == 1 && reader.calls == 1);
+    assert(reader.ready == RD);
+  }
+
+  t_void test_burst_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{8}, service}};
+    t_pipe_       pipes[4];
+    t_reader_     readers[4];
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    for (t_n_ ix = 0; ix < 4; ++ix)
+      dispatcher.add_event(err, {t_fd{pipes[ix].fds[0]}, RD}, &readers[ix]);
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && loop.batches == 1);
+    for (auto& reader : readers)
+      assert(reader.calls == 1);
+  }
+
+  t_void test_edge_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service}};
+    t_pipe_       pipe;
+    t_reader_     reader;
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    pipe.add(); // two bytes of which only one is read
+    dispatcher.add_event(err, {t_fd{pipe.fds[0]}, RD, 0,
+                               t_event_user{0L}, EDGE_MODE}, &reader);
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && reader.calls == 1);
+    dispatcher.event_loop(&loop, t_usec{20000});
+    assert(loop.batches == 1 && reader.calls == 1);
+    pipe.add();
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && loop.batches == 2 && reader.calls == 2);
+  }
+
+  t_void test_oneshot_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service}};
+    t_pipe_       pipe;
+    t_reader_     reader, quitter;
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    pipe.add();
+    pipe.add(); // stays readable throughout
+    const t_id id = dispatcher.add_event(err, {t_fd{pipe.fds[0]}, RD, 0,
+                                               t_event_user{0L},
+                                               ONESHOT_MODE}, &reader);
+    loop.quit_after = 2;
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && loop.batches == 2 && reader.calls == 2);
+
+    t_pipe_ other;
+    other.add();
+    quitter.action = t_action{QUIT_EVENT_LOOP};
+    dispatcher.add_event(err, {t_fd{other.fds[0]}, RD, 0,
+                               t_event_user{0L}, ONESHOT_MODE}, &quitter);
+    dispatcher.del_event(err, id);
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && quitter.calls == 1);
+    dispatcher.event_loop(&loop, t_usec{20000});
+    assert(loop.batches == 2 && quitter.calls == 1);
+  }
+
+  t_void test_rd_wr_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service}};
+    t_reader_     reader;
+    t_loop_       loop;
+    int           fds[2];
+    assert(!err && dispatcher == VALID);
+
+    assert(!::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+    assert(::write(fds[1], "x", 1) == 1);
+    dispatcher.add_event(err, {t_fd{fds[0]}, RD_WR}, &reader);
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && reader.calls == 1 && reader.ready == RD_WR);
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+
+  t_void test_timers_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service, t_n{8}}};
+    t_timers_     timers;
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    // 100 msecs is beyond the 64 slots of the lowest level.
+    timers.last = 3;
+    dispatcher.start_timer(err, t_usec{100000}, &timers, t_timer_user{3L});
+    dispatcher.start_timer(err, t_usec{10000},  &timers, t_timer_user{1L});
+    dispatcher.start_timer(err, t_usec{30000},  &timers, t_timer_user{2L});
+    const t_timer_id stopped = dispatcher.start_timer(err, t_usec{20000},
+                                                      &timers,
+                                                      t_timer_user{4L});
+    assert(!err && dispatcher.stop_timer(stopped));
+    assert(!dispatcher.stop_timer(stopped));
+    // a few waits, one per expiry or cascade, rather than a spin.
+    assert(get(dispatcher.event_loop(&loop)) < 20);
+    assert(loop.batches == 0);
+    assert((timers.fired == std::vector<t_n_>{1, 2, 3}));
+    assert(timers.msecs[0] >= 10 && timers.msecs[1] >= 30);
+    assert(timers.msecs[2] >= 100 && timers.msecs[2] < 1000);
+  }
+
+  t_void test_event_timers_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service, t_n{8}}};
+    t_pipe_       pipe;
+    t_reader_     reader;
+    t_timers_     timers;
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    char byte;
+    assert(::read(pipe.fds[0], &byte, 1) == 1); // never readable
+    const t_id id = dispatcher.add_event(err, {t_fd{pipe.fds[0]}, RD},
+                                         &reader);
+    dispatcher.start_event_timer(err, id, t_usec{10000});
+    dispatcher.start_event_timer(err, id, t_usec{20000});
+    timers.last = 1;
+    dispatcher.start_timer(err, t_usec{50000}, &timers, t_timer_user{1L});
+    assert(!err);
+    dispatcher.event_loop(&loop);
+    assert(reader.timers == 1 && reader.calls == 0);
+    assert(!dispatcher.get_event(id));
+    assert(timers.fired.size() == 1 && timers.msecs[0] >= 50);
+  }
+
+  t_void test_level_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service}};
+    t_pipe_       pipe;
+    t_reader_     reader;
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    pipe.add();
+    pipe.add(); // three bytes, read one per wait
+    dispatcher.add_event(err, {t_fd{pipe.fds[0]}, RD}, &reader);
+    loop.quit_after = 3;
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && loop.batches == 3 && reader.calls == 3);
+    dispatcher.event_loop(&loop, t_usec{20000});
+    assert(loop.batches == 3 && reader.calls == 3);
+  }
+
+  t_void test_prio_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service, t_n{0}, false,
+                                           PRIO_ORDER}};
+    t_pipe_       pipes[3];
+    t_reader_     readers[3];
+    t_loop_       loop;
+    t_order_      order;
+    assert(!err && dispatcher == VALID);
+
+    const t_event_prio prios[3] = {2, 0, 1};
+    for (t_n_ ix = 0; ix < 3; ++ix) {
+      readers[ix].order = &order;
+      dispatcher.add_event(err, {t_fd{pipes[ix].fds[0]}, RD, prios[ix]},
+                           &readers[ix]);
+    }
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && loop.batches == 1);
+    assert((order == t_order_{0, 1, 2}));
+  }
+
+  t_void test_prio_drain_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service, t_n{0}, false,
+                                           PRIO_ORDER, t_n{1}}};
+    t_pipe_       bulk, control;
+    t_reader_     bulk_reader, control_reader;
+    t_loop_       loop;
+    t_order_      order;
+    assert(!err && dispatcher == VALID);
+
+    // control stays readable after its first call, so the poll made after
+    // prio 0 reports it again, which needs a re-arm with io_uring.
+    control.add();
+    bulk_reader.order = control_reader.order = &order;
+    dispatcher.add_event(err, {t_fd{bulk.fds[0]}, RD, 1}, &bulk_reader);
+    dispatcher.add_event(err, {t_fd{control.fds[0]}, RD, 0},
+                         &control_reader);
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && loop.batches == 1);
+    if (service == P_cstr("io_uring_sqpoll_service"))
+      assert(order.size() >= 2 && order.front() == 0 && order.back() == 1);
+    else
+      assert((order == t_order_{0, 0, 1}));
+  }
+
+  t_void test_busy_(R_service_name service) {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, service}};
+    t_pipe_       pipe;
+    t_reader_     reader;
+    t_hook_       hook;
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    // without an idle time only the work of the hook keeps it polling.
+    hook.busy       = true;
+    hook.quit_at    = 1000;
+    loop.quit_after = 1000;
+    dispatcher.add_event(err, {t_fd{pipe.fds[0]}, RD}, &reader);
+    dispatcher.busy_event_loop(err, &loop, t_usec{0}, &hook);
+    assert(!err && hook.polls == 1000);
+    assert(loop.batches == 1 && reader.calls == 1);
+  }
+
+  t_void test_busy_idle_(R_service_name service) {
+    t_dispatcher  dispatcher{t_params{t_n{4}, service, t_n{8}}};
+    t_timers_     timers;
+    t_hook_       hook;
+    t_loop_       loop;
+    assert(dispatcher == VALID);
+
+    // polls for 20 msecs and then blocks until the timer is due. after
+    // that the hook is only called when a wait returns.
+    hook.late   = 40;
+    timers.last = 1;
+    dispatcher.start_timer(t_usec{100000}, &timers, t_timer_user{1L});
+    dispatcher.busy_event_loop(&loop, t_usec{20000}, &hook);
+    assert(hook.polls > 10 && hook.lates < 5);
+    assert(timers.fired.size() == 1 && timers.msecs[0] >= 100);
+  }
+
+  t_void test_failed_poll_() {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4},
+                                           P_cstr("io_uring_service")}};
+    t_reader_     reader;
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    const int closed = ::dup(0);
+    ::close(closed);
+    dispatcher.add_event(err, {t_fd{closed}, RD}, &reader);
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && loop.batches == 1 && reader.calls == 1);
+    assert(reader.ready == RD && reader.action.cmd == REMOVE_EVENT);
+  }
+
+  t_void test_failed_deferred_add_() {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, P_cstr("epoll_service"),
+                                           t_n{0}, false, NO_PRIO_ORDER,
+                                           t_n{0}, DEFERRED_CTL}};
+    t_pipe_       pipe;
+    t_reader_     reader, unpollable;
+    t_loop_       loop;
+    assert(!err && dispatcher == VALID);
+
+    const int null = ::open("/dev/null", O_RDONLY); // epoll refuses it
+    const t_id id = dispatcher.add_event(err, {t_fd{null}, RD}, &unpollable);
+    dispatcher.add_event(err, {t_fd{pipe.fds[0]}, RD}, &reader);
+    assert(!err);
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && loop.batches == 1 && loop.removed == 1);
+    assert(reader.calls == 1 && unpollable.calls == 0);
+    assert(!dispatcher.get_event(id));
+    ::close(null);
+  }
+
+  t_void test_event_stats_() {
+    err::t_err    err;
+    t_dispatcher  dispatcher{err, t_params{t_n{4}, P_cstr("epoll_service"),
+                                           t_n{0}, true}};
+    t_pipe_       pipe;
+    t_reader_     reader;
+    t_loop_       loop;
+    t_event_stats stats;
+    assert(!err && dispatcher == VALID);
+
+    const t_id id = dispatcher.add_event(err, {t_fd{pipe.fds[0]}, RD},
+                                         &reader);
+    assert(!err && !dispatcher.get_event_stats(t_id{get(id) + 1}, stats));
+    dispatcher.event_loop(err, &loop, t_usec{1000000});
+    assert(!err && dispatcher.get_event_stats(id, stats) && stats.cnt == 1);
+
+    t_events_stats events;
+    dispatcher.get_events_stats(events);
+    assert(events.size() == 1 && events[0].id == id);
+    assert(events[0].stats.cnt == 1);
+    dispatcher.display();
+
+    dispatcher.del_event(id);
+    assert(!dispatcher.get_event_stats(id, stats));
+    dispatcher.get_events_stats(events);
+    assert(events.empty());
+  }
+}
+
+int main() {
+  for (t_n_ ix = 0; ix < get(get_supported_services()); ++ix)
+    test_ready_(get_supported_service(t_ix{ix}));
+  for (t_n_ ix = 0; ix < get(get_supported_services()); ++ix)
+    test_burst_(get_supported_service(t_ix{ix}));
+  for (t_n_ ix = 0; ix < get(get_supported_services()); ++ix) {
+    test_edge_   (get_supported_service(t_ix{ix}));
+    test_oneshot_(get_supported_service(t_ix{ix}));
+    test_rd_wr_  (get_supported_service(t_ix{ix}));
+  }
+  for (t_n_ ix = 0; ix < get(get_supported_services()); ++ix) {
+    test_timers_      (get_supported_service(t_ix{ix}));
+    test_event_timers_(get_supported_service(t_ix{ix}));
+  }
+  for (t_n_ ix = 0; ix < get(get_supported_services()); ++ix) {
+    test_level_     (get_supported_service(t_ix{ix}));
+    test_prio_      (get_supported_service(t_ix{ix}));
+    test_prio_drain_(get_supported_service(t_ix{ix}));
+  }
+  for (t_n_ ix = 0; ix < get(get_supported_services()); ++ix) {
+    test_busy_     (get_supported_service(t_ix{ix}));
+    test_busy_idle_(get_supported_service(t_ix{ix}));
+  }
+  if (get(get_supported_services()) > 1)
+    test_failed_poll_();
+  test_failed_deferred_add_();
+  test_event_stats_();
+  return 0;
+}
@@ -0,0 +1,91 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+#ifndef _DAINTY_MT_INTERNAL__H_
+#define _DAINTY_MT_INTERNAL__H_
+
+// description
+// helpers shared by the implementation files of dainty_mt. not part of the
+// interface, only to be included from .cpp files.
+
+#include <chrono>
+#include "dainty_named.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace internal_
+{
+  using named::t_n_;
+  using named::t_bool;
+  using named::t_void;
+  using named::t_uint64;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  enum { CACHE_LINE = 64 };
+
+  // fields on either side of a pad never share a cache line.
+  struct t_pad_ {
+    char bytes[CACHE_LINE];
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  inline t_void cpu_relax_() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+  }
+
+  // poll with exponential pause backoff until ready or the nsecs are spent.
+  template<typename F>
+  inline t_bool spin_wait_(t_uint64 nsecs, F ready) noexcept {
+    if (nsecs) {
+      using t_clock = std::chrono::steady_clock;
+      const auto end = t_clock::now() + std::chrono::nanoseconds(nsecs);
+      t_n_ backoff = 1;
+      do {
+        for (t_n_ n = backoff; n; --n)
+          cpu_relax_();
+        if (ready())
+          return true;
+        if (backoff < 64)
+          backoff <<= 1;
+      } while (t_clock::now() < end);
+    }
+    return false;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
+
+#endif
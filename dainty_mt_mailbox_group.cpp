@@ -0,0 +1,308 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+#include <new>
+#include <atomic>
+#include "dainty_os_fdbased.h"
+#include "dainty_mt_mailbox_group.h"
+#include "dainty_mt_internal_.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace mailbox_group
+{
+  using err::r_err;
+  using named::t_n_;
+  using named::t_bool;
+  using named::t_uint64;
+  using named::BAD_FD;
+  using dainty::os::fdbased::t_eventfd;
+  using internal_::CACHE_LINE;
+  using internal_::t_pad_;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  namespace
+  {
+    enum { BITS = 64 };
+
+    // every mailbox count gets its own cache line.
+    struct alignas(CACHE_LINE) t_mailbox_ {
+      std::atomic<t_cnt_> cnt{0};
+      t_processor::t_logic* logic = nullptr;
+    };
+
+    struct alignas(CACHE_LINE) t_word_ {
+      std::atomic<t_uint64> bits{0};
+    };
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_impl_ {
+  public:
+    using r_logic = t_processor::r_logic;
+
+    t_impl_(r_err err, t_n max) noexcept
+      : max_{get(max)}, words_cnt_{(max_ + BITS - 1)/BITS},
+        mailboxes_{new (std::nothrow) t_mailbox_[max_]},
+        words_{new (std::nothrow) t_word_[words_cnt_]},
+        eventfd_(err, t_n{0}) {
+      if (max_ && mailboxes_ && words_ && eventfd_ == VALID)
+        valid_ = VALID;
+    }
+
+    ~t_impl_() {
+      delete [] mailboxes_;
+      delete [] words_;
+    }
+
+    operator t_validity() const noexcept {
+      return valid_;
+    }
+
+    t_fd get_fd() const noexcept {
+      return eventfd_.get_fd();
+    }
+
+    t_member add_member(r_err err, r_logic logic) noexcept {
+      if (members_ < max_) {
+        mailboxes_[members_].logic = &logic;
+        return t_member{members_++};
+      }
+      err = err::E_XXX;
+      return t_member{0};
+    }
+
+    t_errn post(t_member member, t_cnt cnt) noexcept {
+      if (get(member) < members_ && get(cnt)) {
+        if (!mark_(get(member), get(cnt))) {
+          t_eventfd::t_value value = 1;
+          return eventfd_.write(value);
+        }
+        return t_errn{0};
+      }
+      return t_errn{-1};
+    }
+
+    t_void post(r_err err, t_member member, t_cnt cnt) noexcept {
+      if (get(member) < members_ && get(cnt)) {
+        if (!mark_(get(member), get(cnt))) {
+          t_eventfd::t_value value = 1;
+          eventfd_.write(err, value);
+        }
+      } else
+        err = err::E_XXX;
+    }
+
+    t_void process(r_err err, t_n max) noexcept {
+      for (t_n_ n = get(max); !err && n; --n) {
+        t_eventfd::t_value value = 0;
+        eventfd_.read(err, value);
+        if (!err) {
+          signalled_.store(false);
+          dispatch_();
+        }
+      }
+    }
+
+    // the eventfd is only read when it is signalled: the producer that set
+    // signalled_ writes it right after, so the read does not block. it
+    // must be read, or signalled_ stays set and no post wakes process.
+    t_void process_available(r_err err) noexcept {
+      if (signalled_.load()) {
+        t_eventfd::t_value value = 0;
+        eventfd_.read(err, value);
+        if (!err)
+          signalled_.store(false);
+      }
+      if (!err)
+        dispatch_();
+    }
+
+    t_client make_client(t_member member, t_user user) noexcept {
+      if (get(member) < members_)
+        return {this, member, user};
+      return {};
+    }
+
+    t_client make_client(r_err err, t_member member, t_user user) noexcept {
+      if (get(member) < members_)
+        return {this, member, user};
+      err = err::E_XXX;
+      return {};
+    }
+
+  private:
+    // returns true when the consumer is already signalled. the count is
+    // added before the bit is set, and the consumer clears the bit before
+    // it takes the count, so no post is ever lost.
+    t_bool mark_(t_member_ member, t_cnt_ cnt) noexcept {
+      if (!mailboxes_[member].cnt.fetch_add(cnt)) {
+        words_[member/BITS].bits.fetch_or(t_uint64{1} << (member % BITS));
+        return signalled_.exchange(true);
+      }
+      return true;
+    }
+
+    t_void dispatch_() noexcept {
+      for (t_n_ word = 0; word < words_cnt_; ++word) {
+        t_uint64 bits = words_[word].bits.exchange(0);
+        while (bits) {
+          const t_n_ bit    = __builtin_ctzll(bits);
+          const t_n_ member = word*BITS + bit;
+          bits &= bits - 1;
+          const t_cnt_ cnt = mailboxes_[member].cnt.exchange(0);
+          if (cnt)
+            mailboxes_[member].logic->async_process(t_member{member},
+                                                    t_cnt{cnt});
+        }
+      }
+    }
+
+    t_validity          valid_ = INVALID;
+    const t_n_          max_;
+    const t_n_          words_cnt_;
+    t_mailbox_*         mailboxes_;
+    t_word_*            words_;
+    t_eventfd           eventfd_;
+    t_n_                members_ = 0;
+    t_pad_              pad1_;
+    std::atomic<t_bool> signalled_{false};
+    t_pad_              pad2_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  t_client::t_client(t_impl_user_ impl, t_member member, t_user user) noexcept
+    : impl_{impl}, member_{member}, user_{user} {
+  }
+
+  t_client::t_client(x_client client) noexcept
+    : impl_{client.impl_.release()},
+      member_{named::utility::reset(client.member_)},
+      user_{named::utility::reset(client.user_)} {
+  }
+
+  t_client::operator t_validity() const noexcept {
+    return impl_ == VALID && *impl_ == VALID ? VALID : INVALID;
+  }
+
+  t_errn t_client::post(t_cnt cnt) noexcept {
+    if (*this == VALID)
+      return impl_->post(member_, cnt);
+    return t_errn{-1};
+  }
+
+  t_void t_client::post(t_err err, t_cnt cnt) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->post(err, member_, cnt);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  t_processor::t_processor(t_err err, t_n max) noexcept {
+    ERR_GUARD(err) {
+      impl_ = new t_impl_(err, max);
+      if (impl_ == VALID) {
+        if (err)
+          impl_.clear();
+      } else
+        err = err::E_XXX;
+    }
+  }
+
+  t_processor::t_processor(x_processor processor) noexcept
+    : impl_{processor.impl_.release()} {
+  }
+
+  t_processor::~t_processor() {
+    impl_.clear();
+  }
+
+  t_processor::operator t_validity() const noexcept {
+    return impl_ == VALID && *impl_ == VALID ? VALID : INVALID;
+  }
+
+  t_fd t_processor::get_fd() const noexcept {
+    if (*this == VALID)
+      return impl_->get_fd();
+    return BAD_FD;
+  }
+
+  t_member t_processor::add_member(t_err err, r_logic logic) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->add_member(err, logic);
+      err = err::E_XXX;
+    }
+    return t_member{0};
+  }
+
+  t_void t_processor::process(t_err err, t_n max) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->process(err, max);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_void t_processor::process_available(t_err err) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->process_available(err);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_client t_processor::make_client(t_member member, t_user user) noexcept {
+    if (*this == VALID)
+      return impl_->make_client(member, user);
+    return {};
+  }
+
+  t_client t_processor::make_client(t_err err, t_member member,
+                                    t_user user) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->make_client(err, member, user);
+      err = err::E_XXX;
+    }
+    return {};
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
@@ -0,0 +1,92 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// posts are handed out per mailbox, and draining with process_available
+// leaves the group so that the next post signals the eventfd again.
+
+#include <poll.h>
+#include <cassert>
+#include "dainty_mt_mailbox_group.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::mailbox_group;
+
+namespace
+{
+  using named::t_n_;
+
+  struct t_logic_ : t_processor::t_logic {
+    t_n_ calls = 0;
+    t_n_ cnt   = 0;
+
+    t_void async_process(t_member, t_cnt _cnt) noexcept override {
+      ++calls;
+      cnt += get(_cnt);
+    }
+  };
+
+  named::t_bool readable_(t_fd fd) {
+    ::pollfd pfd = { get(fd), POLLIN, 0 };
+    return ::poll(&pfd, 1, 0) == 1;
+  }
+}
+
+int main() {
+  err::t_err err;
+  t_processor processor{err, t_n{100}};
+  assert(!err && processor == VALID);
+
+  t_logic_ logics[3];
+  for (auto& logic : logics)
+    processor.add_member(err, logic);
+  t_client first = processor.make_client(err, t_member{0}, t_user{1L});
+  t_client last  = processor.make_client(err, t_member{2}, t_user{2L});
+  assert(!err && first == VALID && last == VALID);
+
+  first.post(err);
+  first.post(err, t_cnt{2});
+  last.post(err);
+  assert(!err && readable_(processor.get_fd()));
+  processor.process(err);
+  assert(!err && !readable_(processor.get_fd()));
+  assert(logics[0].calls == 1 && logics[0].cnt == 3);
+  assert(logics[1].calls == 0);
+  assert(logics[2].calls == 1 && logics[2].cnt == 1);
+
+  for (t_n_ round = 0; round < 3; ++round) {
+    last.post(err);
+    assert(!err && readable_(processor.get_fd()));
+    processor.process_available(err);
+    assert(!err && !readable_(processor.get_fd()));
+    assert(logics[2].calls == 2 + round);
+  }
+
+  processor.process_available(err);
+  assert(!err && logics[2].calls == 4);
+  return 0;
+}
@@ -0,0 +1,398 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+#include <new>
+#include "dainty_os_fdbased.h"
+#include "dainty_os_threading.h"
+#include "dainty_mt_priority_chained_queue.h"
+#include "dainty_mt_internal_.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace priority_chained_queue
+{
+  using err::r_err;
+  using named::t_n_;
+  using named::t_bool;
+  using dainty::os::t_errn;
+  using namespace dainty::os::threading;
+  using namespace dainty::os::fdbased;
+
+  using internal_::t_pad_;
+  using t_queue = container::chained_queue::t_chained_queue<t_any>;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_lane_ {
+  public:
+    t_lane_(r_err err, t_n max, t_n_ _weight) noexcept
+      : queue{err, max}, weight{_weight}, credit{_weight} {
+    }
+
+    t_queue queue;
+    t_bool  ready  = false; // holds chains, guarded by lock2_
+    t_n_    weight;
+    t_n_    credit;
+  };
+  using p_lane_ = t_prefix<t_lane_>::p_;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_impl_ {
+  public:
+    using t_chain = t_queue::t_chain;
+    using r_logic = t_processor::r_logic;
+
+    t_impl_(r_err err, R_params params) noexcept
+      : sched_{params.sched}, prios_{get(params.prios)},
+        lanes_{new (std::nothrow) p_lane_[prios_]()},
+        eventfd_(err, t_n{0}), lock1_{err}, lock2_{err} {
+      if (prios_ && lanes_ && eventfd_ == VALID && lock1_ == VALID &&
+          lock2_ == VALID) {
+        t_bool valid = true;
+        for (t_n_ ix = 0; !err && valid && ix < prios_; ++ix) {
+          t_n_ weight = ix < params.weights.size() ?
+                          get(params.weights[ix]) : 1;
+          lanes_[ix] = new (std::nothrow) t_lane_(err, params.max,
+                                                  weight ? weight : 1);
+          valid = lanes_[ix] && lanes_[ix]->queue == VALID;
+        }
+        if (!err && valid)
+          valid_ = VALID;
+      }
+    }
+
+    ~t_impl_() {
+      if (lanes_) {
+        for (t_n_ ix = 0; ix < prios_; ++ix)
+          delete lanes_[ix];
+        delete [] lanes_;
+      }
+    }
+
+    operator t_validity() const noexcept {
+      return valid_;
+    }
+
+    t_void process(r_err err, r_logic logic, t_n max) noexcept {
+      for (t_n_ n = get(max); !err && n; --n) {
+        t_chain chain;
+        t_n_    prio  = 0;
+        t_bool  woken = false;
+        t_bool  found = false;
+        do {
+          <% auto scope = lock2_.make_locked_scope(err);
+            if (!err) {
+              if (woken)
+                signalled_ = false; // the blocking read took the write
+              found = remove_(err, prio, chain);
+            }
+          %>
+          if (!err && !found) {
+            t_eventfd::t_value value = 0;
+            eventfd_.read(err, value);
+            woken = true;
+          }
+        } while (!err && !found);
+
+        if (found) {
+          logic.async_process(t_prio{prio}, chain);
+          release_(err, prio, chain);
+        }
+      }
+    }
+
+    t_void process_available(r_err err, r_logic logic) noexcept {
+      t_chain chain;
+      t_n_    prio  = 0;
+      t_bool  found = false;
+      <% auto scope = lock2_.make_locked_scope(err);
+        if (!err)
+          found = remove_(err, prio, chain);
+      %>
+      if (found) {
+        logic.async_process(t_prio{prio}, chain);
+        release_(err, prio, chain);
+      }
+    }
+
+    t_chain acquire(t_user, t_prio prio, t_n n) noexcept {
+      if (get(prio) < prios_) {
+        <% auto scope = lock1_.make_locked_scope();
+          if (scope == VALID)
+            return lanes_[get(prio)]->queue.acquire(n);
+        %>
+      }
+      return {};
+    }
+
+    t_chain acquire(r_err err, t_user, t_prio prio, t_n n) noexcept {
+      if (get(prio) < prios_) {
+        <% auto scope = lock1_.make_locked_scope(err);
+          return lanes_[get(prio)]->queue.acquire(err, n);
+        %>
+      } else
+        err = err::E_XXX;
+      return {};
+    }
+
+    t_errn insert(t_user, t_prio prio, t_chain& chain) noexcept {
+      t_errn errn{-1};
+      if (get(chain.cnt) && get(prio) < prios_) {
+        <% auto scope = lock2_.make_locked_scope();
+          if (scope == VALID) {
+            t_lane_& lane = *lanes_[get(prio)];
+            lane.queue.insert(chain);
+            set(errn) = 0;
+            if (!lane.ready) {
+              lane.ready = true;
+              if (!ready_++) {
+                t_eventfd::t_value value = 1;
+                errn = eventfd_.write(value);
+                signalled_ = errn == VALID;
+              }
+            }
+          }
+        %>
+      }
+      return errn;
+    }
+
+    t_void insert(r_err err, t_user, t_prio prio, t_chain& chain) noexcept {
+      if (get(chain.cnt) && get(prio) < prios_) {
+        <% auto scope = lock2_.make_locked_scope(err);
+          if (!err) {
+            t_lane_& lane = *lanes_[get(prio)];
+            lane.queue.insert(err, chain);
+            if (!err && !lane.ready) {
+              lane.ready = true;
+              if (!ready_++) {
+                t_eventfd::t_value value = 1;
+                eventfd_.write(err, value);
+                signalled_ = !err;
+              }
+            }
+          }
+        %>
+      } else
+        err = err::E_XXX;
+    }
+
+    t_fd get_fd() const noexcept {
+      return eventfd_.get_fd();
+    }
+
+    t_client make_client(t_user user) noexcept {
+      // NOTE: future, we have information on clients.
+      return {this, user};
+    }
+
+    t_client make_client(r_err, t_user user) noexcept {
+      // NOTE: future, we have information on clients.
+      return {this, user};
+    }
+
+  private:
+    // lock2_ is held by the caller.
+    t_n_ select_() noexcept {
+      if (sched_ == STRICT_SCHED) {
+        t_n_ ix = 0;
+        while (!lanes_[ix]->ready)
+          ++ix;
+        return ix;
+      }
+      // every lane gets its credit back once it is passed over, so within
+      // two rounds a lane with chains is found.
+      for (;;) {
+        t_lane_& lane = *lanes_[next_];
+        if (lane.ready && lane.credit) {
+          --lane.credit;
+          return next_;
+        }
+        lane.credit = lane.weight;
+        next_ = (next_ + 1) % prios_;
+      }
+    }
+
+    // lock2_ is held by the caller. the eventfd stays readable as long as
+    // any lane holds a chain, it is read back when the last one goes.
+    // remove takes all chains of a lane, which leaves it empty.
+    t_bool remove_(r_err err, t_n_& prio, t_chain& chain) noexcept {
+      if (ready_) {
+        prio = select_();
+        t_lane_& lane = *lanes_[prio];
+        chain = lane.queue.remove(err);
+        if (!err && get(chain.cnt)) {
+          lane.ready = false;
+          if (!--ready_ && named::utility::reset(signalled_)) {
+            t_eventfd::t_value value = 0;
+            eventfd_.read(err, value);
+          }
+          return true;
+        }
+      }
+      return false;
+    }
+
+    t_void release_(r_err err, t_n_ prio, t_chain& chain) noexcept {
+      <% auto scope = lock1_.make_locked_scope(err);
+        lanes_[prio]->queue.release(err, chain);
+      %>
+    }
+
+    t_validity    valid_ = INVALID;
+    const t_sched sched_;
+    const t_n_    prios_;
+    p_lane_*      lanes_;
+    t_eventfd     eventfd_;
+    t_pad_        pad1_;
+    // free lists of all lanes: producers acquire, the consumer releases.
+    t_mutex_lock  lock1_;
+    t_pad_        pad2_;
+    // ready lists of all lanes: producers insert, the consumer removes.
+    t_mutex_lock  lock2_;
+    t_n_          ready_     = 0; // lanes that hold chains
+    t_bool        signalled_ = false;
+    t_n_          next_      = 0;
+    t_pad_        pad3_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  t_client::t_client(t_impl_user_ impl, t_user user) noexcept
+    : impl_{impl}, user_{user} {
+  }
+
+  t_client::t_client(x_client client) noexcept
+    : impl_{client.impl_.release()},
+      user_{named::utility::reset(client.user_)} {
+  }
+
+  t_client::operator t_validity() const noexcept {
+    return impl_ == VALID && *impl_ == VALID ? VALID : INVALID;
+  }
+
+  t_client::t_chain t_client::acquire(t_prio prio, t_n cnt) noexcept {
+    if (*this == VALID)
+      return impl_->acquire(user_, prio, cnt);
+    return {};
+  }
+
+  t_client::t_chain t_client::acquire(t_err err, t_prio prio,
+                                      t_n cnt) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->acquire(err, user_, prio, cnt);
+      err = err::E_XXX;
+    }
+    return {};
+  }
+
+  t_errn t_client::insert(t_prio prio, t_chain chain) noexcept {
+    if (*this == VALID)
+      return impl_->insert(user_, prio, chain);
+    return t_errn{-1};
+  }
+
+  t_void t_client::insert(t_err err, t_prio prio, t_chain chain) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->insert(err, user_, prio, chain);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  t_processor::t_processor(t_err err, R_params params) noexcept {
+    ERR_GUARD(err) {
+      impl_ = new t_impl_(err, params);
+      if (impl_ == VALID) {
+        if (err)
+          impl_.clear();
+      } else
+        err = err::E_XXX;
+    }
+  }
+
+  t_processor::t_processor(x_processor processor) noexcept
+    : impl_{processor.impl_.release()} {
+  }
+
+  t_processor::~t_processor() {
+    impl_.clear();
+  }
+
+  t_processor::operator t_validity() const noexcept {
+    return impl_ == VALID && *impl_ == VALID ? VALID : INVALID;
+  }
+
+  t_client t_processor::make_client(t_user user) noexcept {
+    if (*this == VALID)
+      return impl_->make_client(user);
+    return {};
+  }
+
+  t_client t_processor::make_client(t_err err, t_user user) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->make_client(err, user);
+      err = err::E_XXX;
+    }
+    return {};
+  }
+
+  t_void t_processor::process(t_err err, r_logic logic, t_n max) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->process(err, logic, max);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_void t_processor::process_available(t_err err, r_logic logic) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->process_available(err, logic);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_fd t_processor::get_fd() const noexcept {
+    if (*this == VALID)
+      return impl_->get_fd();
+    return BAD_FD;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
@@ -0,0 +1,188 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+#ifndef _DAINTY_MT_PRIORITY_CHAINED_QUEUE_H_
+#define _DAINTY_MT_PRIORITY_CHAINED_QUEUE_H_
+
+// description
+// priority_chained_queue is a chained_queue with several lanes, one per
+// priority, behind a single eventfd. every lane has its own pool of slots.
+// the processor drains the lanes by strict priority or by weighted
+// round-robin.
+
+#include <vector>
+#include "dainty_named_ptr.h"
+#include "dainty_named_utility.h"
+#include "dainty_container_any.h"
+#include "dainty_container_chained_queue.h"
+#include "dainty_mt_err.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace priority_chained_queue
+{
+  using named::t_fd;
+  using named::t_n;
+  using named::t_void;
+  using named::t_validity;
+  using named::VALID;
+  using named::INVALID;
+  using named::t_errn;
+  using named::t_prefix;
+  using err::t_err;
+
+  enum  t_user_tag_ { };
+  using t_user = named::t_user<t_user_tag_>;
+
+  using t_any   = container::any::t_any;
+  using t_chain = container::chained_queue::t_chain<t_any>;
+
+  // 0 is the highest priority.
+  enum  t_prio_tag_ { };
+  using t_prio_ = named::t_n_;
+  using t_prio  = named::t_explicit<t_prio_, t_prio_tag_>;
+
+  // STRICT_SCHED:   a lane is only served when all higher lanes are empty.
+  // WEIGHTED_SCHED: lanes are served round-robin, each for up to its
+  //                 weight chains in a row, so low lanes cannot starve.
+  enum t_sched { STRICT_SCHED, WEIGHTED_SCHED };
+
+  using t_weights = std::vector<t_n>;
+  using R_weights = named::t_prefix<t_weights>::R_;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_params {
+  public:
+    t_n       max;     // slots per lane
+    t_n       prios;   // number of lanes
+    t_sched   sched;
+    t_weights weights; // WEIGHTED_SCHED, one per lane, missing ones are 1
+
+    inline
+    t_params(t_n _max, t_n _prios, t_sched _sched = STRICT_SCHED,
+             R_weights _weights = t_weights())
+      : max(_max), prios(_prios), sched(_sched), weights(_weights) {
+    }
+  };
+  using R_params = named::t_prefix<t_params>::R_;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_impl_;
+  enum  t_impl_user_tag_ { };
+  using t_impl_user_ = named::ptr::t_ptr<t_impl_, t_impl_user_tag_,
+                                         named::ptr::t_no_deleter>;
+  enum  t_impl_owner_tag_ { };
+  using t_impl_owner_ = named::ptr::t_ptr<t_impl_, t_impl_owner_tag_,
+                                          named::ptr::t_deleter>;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_client;
+  using r_client = t_prefix<t_client>::r_;
+  using x_client = t_prefix<t_client>::x_;
+  using R_client = t_prefix<t_client>::R_;
+
+  class t_client {
+  public:
+    using t_chain = priority_chained_queue::t_chain;
+
+    t_client(x_client) noexcept;
+
+    r_client operator=(R_client) = delete;
+    r_client operator=(x_client) = delete;
+
+    operator t_validity() const noexcept;
+
+    // a chain must be inserted with the priority it was acquired with.
+    t_chain acquire(       t_prio, t_n = t_n{1}) noexcept;
+    t_chain acquire(t_err, t_prio, t_n = t_n{1}) noexcept;
+
+    t_errn  insert (       t_prio, t_chain)      noexcept;
+    t_void  insert (t_err, t_prio, t_chain)      noexcept;
+
+  private:
+    friend class t_processor;
+    friend class t_impl_;
+    t_client() = default;
+    t_client(t_impl_user_, t_user) noexcept;
+
+    t_impl_user_ impl_;
+    t_user       user_ = t_user{0L};
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_processor;
+  using r_processor = t_prefix<t_processor>::r_;
+  using x_processor = t_prefix<t_processor>::x_;
+  using R_processor = t_prefix<t_processor>::R_;
+
+  class t_processor {
+  public:
+    class t_logic {
+    public:
+      using t_chain = priority_chained_queue::t_chain;
+      using t_prio  = priority_chained_queue::t_prio;
+
+      virtual ~t_logic() { }
+      virtual t_void async_process(t_prio, t_chain) noexcept = 0;
+    };
+
+    using r_logic = t_logic&;
+
+     t_processor(t_err, R_params) noexcept;
+     t_processor(x_processor)     noexcept;
+    ~t_processor();
+
+    t_processor(R_processor)           = delete;
+    r_processor operator=(x_processor) = delete;
+    r_processor operator=(R_processor) = delete;
+
+    operator t_validity () const noexcept;
+
+    // readable while any lane holds a chain.
+    t_fd get_fd() const noexcept;
+
+    t_void process          (t_err, r_logic, t_n max = t_n{1}) noexcept;
+    t_void process_available(t_err, r_logic) noexcept;
+
+    t_client make_client(       t_user) noexcept;
+    t_client make_client(t_err, t_user) noexcept;
+
+  private:
+    t_impl_owner_ impl_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
+
+#endif
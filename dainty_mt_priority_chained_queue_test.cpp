@@ -0,0 +1,146 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// lanes that are drained must stop counting as ready, and WEIGHTED_SCHED
+// must serve a low lane while a higher one never runs dry. STRICT_SCHED
+// serves the highest lane first, whatever the insert order, every lane has
+// a pool of its own and the fd is readable while any lane holds a chain.
+
+#include <poll.h>
+#include <vector>
+#include <cassert>
+#include "dainty_mt_priority_chained_queue.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::priority_chained_queue;
+
+namespace
+{
+  using named::t_n_;
+  using named::t_bool;
+
+  struct t_logic_ : t_processor::t_logic {
+    t_n_ calls = 0;
+    t_n_ prio  = 0;
+    t_n_ cnt   = 0;
+
+    t_void async_process(t_prio _prio, t_chain chain) noexcept override {
+      ++calls;
+      prio = get(_prio);
+      cnt  = get(chain.cnt);
+    }
+  };
+
+  t_void insert_(t_client& client, t_prio prio) {
+    err::t_err err;
+    client.insert(err, prio, client.acquire(err, prio));
+    assert(!err);
+  }
+
+  t_bool readable_(t_fd fd) {
+    pollfd pfd{get(fd), POLLIN, 0};
+    return ::poll(&pfd, 1, 0) == 1;
+  }
+
+  t_void test_strict_() {
+    err::t_err  err;
+    t_processor processor{err, t_params{t_n{2}, t_n{3}}};
+    t_client    client = processor.make_client(err, t_user{1L});
+    assert(!err && processor == VALID && client == VALID);
+    assert(!readable_(processor.get_fd()));
+
+    // a full lane leaves the others their slots.
+    insert_(client, t_prio{2});
+    insert_(client, t_prio{2});
+    assert(!get(client.acquire(t_prio{2}).cnt));
+    insert_(client, t_prio{1});
+    insert_(client, t_prio{0});
+    assert(!get(client.acquire(t_prio{3}).cnt));
+    assert(readable_(processor.get_fd()));
+
+    struct t_order_ : t_logic_ {
+      std::vector<t_n_> prios;
+
+      t_void async_process(t_prio prio, t_chain chain) noexcept override {
+        t_logic_::async_process(prio, chain);
+        prios.push_back(get(prio));
+      }
+    } logic;
+    processor.process(err, logic, t_n{3});
+    assert(!err && (logic.prios == std::vector<t_n_>{0, 1, 2}));
+    assert(logic.cnt == 2 && !readable_(processor.get_fd()));
+
+    // the lane pools are whole again.
+    insert_(client, t_prio{2});
+    insert_(client, t_prio{2});
+    processor.process(err, logic);
+    assert(!err && logic.calls == 4);
+  }
+}
+
+int main() {
+  err::t_err err;
+  {
+    t_processor processor{err, t_params{t_n{4}, t_n{2}}};
+    t_client    client = processor.make_client(err, t_user{1L});
+    assert(!err && processor == VALID && client == VALID);
+
+    // two chains on one lane come out together and empty that lane.
+    insert_(client, t_prio{0});
+    insert_(client, t_prio{0});
+    t_logic_ logic;
+    processor.process(err, logic);
+    assert(!err && logic.calls == 1 && logic.prio == 0 && logic.cnt == 2);
+
+    insert_(client, t_prio{1});
+    processor.process_available(err, logic);
+    assert(!err && logic.calls == 2 && logic.prio == 1 && logic.cnt == 1);
+
+    processor.process_available(err, logic);
+    assert(!err && logic.calls == 2);
+  }
+  {
+    t_processor processor{err, t_params{t_n{4}, t_n{2}, WEIGHTED_SCHED,
+                                        t_weights{t_n{2}, t_n{1}}}};
+    t_client    client = processor.make_client(err, t_user{1L});
+    assert(!err && processor == VALID && client == VALID);
+
+    insert_(client, t_prio{1});
+    t_logic_ logic;
+    t_n_     high = 0;
+    do {
+      insert_(client, t_prio{0});
+      processor.process(err, logic);
+      assert(!err);
+      high += logic.prio == 0;
+    } while (logic.prio == 0 && high <= 2);
+    assert(logic.prio == 1 && high == 2);
+  }
+  test_strict_();
+  return 0;
+}
@@ -0,0 +1,562 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+#include <new>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "dainty_os_fdbased.h"
+#include "dainty_mt_shm_chained_queue.h"
+#include "dainty_mt_internal_.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace shm_chained_queue
+{
+  using err::r_err;
+  using named::t_n_;
+  using named::t_bool;
+  using named::t_uint64;
+  using named::t_int64;
+  using os::fdbased::t_eventfd;
+  using internal_::CACHE_LINE;
+  using internal_::t_pad_;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  namespace
+  {
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+                  "shared atomics must be lock-free to work across processes");
+
+    const t_uint64 MAGIC = 0x6461696e74796d71ULL;
+
+    struct t_cell_ {
+      std::atomic<t_uint64> seq;
+      t_uint64              ix;
+    };
+    using p_cell_ = t_cell_*;
+
+    // lives at the start of the mapping.
+    struct t_header_ {
+      t_uint64              magic;
+      t_uint64              max;       // number of slots
+      t_uint64              slot_size; // usable bytes per slot
+      t_uint64              stride;    // slot_size rounded to cache lines
+      t_uint64              mask;      // ring size - 1
+      t_pad_                pad1;
+      std::atomic<t_uint64> free_head;
+      t_pad_                pad2;
+      std::atomic<t_uint64> free_tail;
+      t_pad_                pad3;
+      std::atomic<t_uint64> ready_head;
+      t_pad_                pad4;
+      std::atomic<t_uint64> ready_tail;
+      t_pad_                pad5;
+      std::atomic<t_int64>  pending;
+      t_pad_                pad6;
+    };
+    using p_header_ = t_header_*;
+
+    inline t_uint64 round_(t_uint64 n) noexcept {
+      return (n + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    }
+
+    inline t_uint64 ring_size_(t_uint64 max) noexcept {
+      t_uint64 size = 1;
+      while (size < max)
+        size <<= 1;
+      return size;
+    }
+
+    // the mapping: header, free ring, ready ring, slots.
+    class t_map_ {
+    public:
+      static t_uint64 size(t_uint64 max, t_uint64 mask,
+                           t_uint64 stride) noexcept {
+        return round_(sizeof(t_header_)) +
+               2*round_((mask + 1)*sizeof(t_cell_)) + max*stride;
+      }
+
+      t_map_() = default;
+      t_map_(p_void base) noexcept
+        : header{static_cast<p_header_>(base)},
+          free {reinterpret_cast<p_cell_>(static_cast<char*>(base) +
+                  round_(sizeof(t_header_)))},
+          ready{free + (header->mask + 1)},
+          slots{static_cast<char*>(base) + round_(sizeof(t_header_)) +
+                  2*round_((header->mask + 1)*sizeof(t_cell_))} {
+      }
+
+      t_slot get_slot(t_uint64 ix) const noexcept {
+        t_slot slot;
+        slot.ix   = t_ix{ix};
+        slot.ptr  = slots + ix*header->stride;
+        slot.size = t_n{header->slot_size};
+        return slot;
+      }
+
+      p_header_ header = nullptr;
+      p_cell_   free   = nullptr;
+      p_cell_   ready  = nullptr;
+      char*     slots  = nullptr;
+    };
+
+    // bounded multi-producer/multi-consumer ring of slot indices.
+    t_bool push_(p_cell_ cells, t_uint64 mask, std::atomic<t_uint64>& tail,
+                 t_uint64 ix) noexcept {
+      t_uint64 pos = tail.load(std::memory_order_relaxed);
+      for (;;) {
+        t_cell_& cell = cells[pos & mask];
+        t_int64  diff = static_cast<t_int64>(
+                          cell.seq.load(std::memory_order_acquire) - pos);
+        if (!diff) {
+          if (tail.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+            cell.ix = ix;
+            cell.seq.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0)
+          return false;
+        else
+          pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    t_bool pop_(p_cell_ cells, t_uint64 mask, std::atomic<t_uint64>& head,
+                t_uint64& ix) noexcept {
+      t_uint64 pos = head.load(std::memory_order_relaxed);
+      for (;;) {
+        t_cell_& cell = cells[pos & mask];
+        t_uint64 seq  = cell.seq.load(std::memory_order_acquire);
+        t_int64  diff = static_cast<t_int64>(seq - (pos + 1));
+        if (!diff) {
+          if (head.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+            ix = cell.ix;
+            cell.seq.store(pos + mask + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0)
+          return false;
+        else
+          pos = head.load(std::memory_order_relaxed);
+      }
+    }
+
+    t_bool send_fds_(t_fd socket, int memfd, int eventfd) noexcept {
+      char  byte = 0;
+      iovec iov{&byte, 1};
+      union {
+        cmsghdr hdr;
+        char    buf[CMSG_SPACE(2*sizeof(int))];
+      } ctrl;
+      std::memset(&ctrl, 0, sizeof(ctrl));
+
+      msghdr msg{};
+      msg.msg_iov        = &iov;
+      msg.msg_iovlen     = 1;
+      msg.msg_control    = ctrl.buf;
+      msg.msg_controllen = sizeof(ctrl.buf);
+
+      cmsghdr* cmsg    = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type  = SCM_RIGHTS;
+      cmsg->cmsg_len   = CMSG_LEN(2*sizeof(int));
+      int fds[2] = { memfd, eventfd };
+      std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+      return ::sendmsg(get(socket), &msg, MSG_NOSIGNAL) == 1;
+    }
+
+    t_bool recv_fds_(t_fd socket, int& memfd, int& eventfd) noexcept {
+      char  byte = 0;
+      iovec iov{&byte, 1};
+      union {
+        cmsghdr hdr;
+        char    buf[CMSG_SPACE(2*sizeof(int))];
+      } ctrl;
+
+      msghdr msg{};
+      msg.msg_iov        = &iov;
+      msg.msg_iovlen     = 1;
+      msg.msg_control    = ctrl.buf;
+      msg.msg_controllen = sizeof(ctrl.buf);
+
+      if (::recvmsg(get(socket), &msg, MSG_CMSG_CLOEXEC) != 1)
+        return false;
+
+      // every descriptor that arrived is now ours. keep them only when
+      // they are exactly the pair that was sent, close them otherwise.
+      int    fds[2];
+      t_n_   n  = 0;
+      t_bool ok = !(msg.msg_flags & MSG_CTRUNC);
+      for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+          continue;
+        const t_n_ cnt = (cmsg->cmsg_len - CMSG_LEN(0))/sizeof(int);
+        for (t_n_ ix = 0; ix < cnt; ++ix) {
+          int fd;
+          std::memcpy(&fd, CMSG_DATA(cmsg) + ix*sizeof(int), sizeof(int));
+          if (n < 2)
+            fds[n] = fd;
+          else
+            ::close(fd);
+          ++n;
+        }
+      }
+      if (ok && n == 2) {
+        memfd   = fds[0];
+        eventfd = fds[1];
+        return true;
+      }
+      for (t_n_ ix = 0; ix < n && ix < 2; ++ix)
+        ::close(fds[ix]);
+      return false;
+    }
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_impl_ {
+  public:
+    using r_logic = t_processor::r_logic;
+
+    t_impl_(r_err err, t_n max, t_n slot_size) noexcept
+      : eventfd_(err, t_n{0}) {
+      if (!err && eventfd_ == VALID && get(max) && get(slot_size)) {
+        const t_uint64 mask   = ring_size_(get(max)) - 1;
+        const t_uint64 stride = round_(get(slot_size));
+        size_  = t_map_::size(get(max), mask, stride);
+        memfd_ = ::memfd_create("dainty_mt_shm_chained_queue", MFD_CLOEXEC);
+        if (memfd_ != -1 && ::ftruncate(memfd_, size_) == 0) {
+          p_void base = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, memfd_, 0);
+          if (base != MAP_FAILED) {
+            base_ = base;
+            p_header_ header = new (base) t_header_();
+            header->max       = get(max);
+            header->slot_size = get(slot_size);
+            header->stride    = stride;
+            header->mask      = mask;
+            map_ = t_map_{base};
+            for (t_uint64 ix = 0; ix <= mask; ++ix) {
+              new (&map_.free [ix]) t_cell_{{ix}, 0};
+              new (&map_.ready[ix]) t_cell_{{ix}, 0};
+            }
+            for (t_uint64 ix = 0; ix < header->max; ++ix)
+              push_(map_.free, mask, header->free_tail, ix);
+            header->magic = MAGIC;
+            valid_ = VALID;
+          }
+        }
+      }
+      if (valid_ != VALID && !err)
+        err = err::E_XXX;
+    }
+
+    ~t_impl_() {
+      if (base_)
+        ::munmap(base_, size_);
+      if (memfd_ != -1)
+        ::close(memfd_);
+    }
+
+    operator t_validity() const noexcept {
+      return valid_;
+    }
+
+    t_fd get_fd() const noexcept {
+      return eventfd_.get_fd();
+    }
+
+    t_errn share(t_fd socket) noexcept {
+      return send_fds_(socket, memfd_, get(eventfd_.get_fd())) ? t_errn{0}
+                                                               : t_errn{-1};
+    }
+
+    t_void share(r_err err, t_fd socket) noexcept {
+      if (share(socket) != VALID)
+        err = err::E_XXX;
+    }
+
+    t_void process(r_err err, r_logic logic, t_n max) noexcept {
+      for (t_n_ n = get(max); !err && n; --n) {
+        t_uint64 ix = 0;
+        while (!err && !pop_(map_.ready, map_.header->mask,
+                             map_.header->ready_head, ix)) {
+          // a producer that claimed a cell but did not publish it yet,
+          // holds up the ring for a moment. only block when nothing is due.
+          if (map_.header->pending.load(std::memory_order_acquire) <= 0)
+            read_(err);
+        }
+        if (!err)
+          deliver_(err, logic, ix);
+      }
+    }
+
+    t_void process_available(r_err err, r_logic logic) noexcept {
+      t_uint64 ix = 0;
+      if (pop_(map_.ready, map_.header->mask, map_.header->ready_head, ix))
+        deliver_(err, logic, ix);
+    }
+
+  private:
+    // same eventfd accounting as a LOCKFREE_MODE chained_queue: written on
+    // the 0->1 transition of pending, read back on its 1->0 transition.
+    t_void read_(r_err err) noexcept {
+      t_eventfd::t_value value = 0;
+      eventfd_.read(err, value);
+      if (!err)
+        consumed_ += value;
+    }
+
+    t_void deliver_(r_err err, r_logic logic, t_uint64 ix) noexcept {
+      if (map_.header->pending.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+          ++owed_ > consumed_)
+        read_(err);
+      logic.async_process(map_.get_slot(ix));
+      push_(map_.free, map_.header->mask, map_.header->free_tail, ix);
+    }
+
+    t_validity valid_    = INVALID;
+    t_eventfd  eventfd_;
+    int        memfd_    = -1;
+    p_void     base_     = nullptr;
+    t_uint64   size_     = 0;
+    t_map_     map_;
+    t_uint64   owed_     = 0;
+    t_uint64   consumed_ = 0;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_client_impl_ {
+  public:
+    t_client_impl_(r_err err, t_fd socket) noexcept : eventfd_{err, t_n{0}} {
+      int eventfd = -1;
+      if (eventfd_ == VALID && recv_fds_(socket, memfd_, eventfd)) {
+        // the processor's eventfd takes the place of our own, so that
+        // insert signals it through t_eventfd.
+        const t_bool adopted = ::dup3(eventfd, get(eventfd_.get_fd()),
+                                      O_CLOEXEC) != -1;
+        ::close(eventfd);
+        struct stat st;
+        if (adopted && ::fstat(memfd_, &st) == 0 &&
+            static_cast<t_uint64>(st.st_size) >= sizeof(t_header_)) {
+          size_ = st.st_size;
+          p_void base = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, memfd_, 0);
+          if (base != MAP_FAILED) {
+            base_ = base;
+            p_header_ header = static_cast<p_header_>(base);
+            if (header->magic == MAGIC &&
+                t_map_::size(header->max, header->mask, header->stride) <=
+                  size_) {
+              map_   = t_map_{base};
+              valid_ = VALID;
+            }
+          }
+        }
+      }
+      if (valid_ != VALID)
+        err = err::E_XXX;
+    }
+
+    ~t_client_impl_() {
+      if (base_)
+        ::munmap(base_, size_);
+      if (memfd_ != -1)
+        ::close(memfd_);
+    }
+
+    operator t_validity() const noexcept {
+      return valid_;
+    }
+
+    t_slot acquire() noexcept {
+      t_uint64 ix = 0;
+      if (pop_(map_.free, map_.header->mask, map_.header->free_head, ix))
+        return map_.get_slot(ix);
+      return {};
+    }
+
+    t_errn insert(t_slot slot) noexcept {
+      const t_uint64 ix = get(slot.ix);
+      if (slot == VALID && ix < map_.header->max &&
+          push_(map_.ready, map_.header->mask, map_.header->ready_tail, ix)) {
+        if (!map_.header->pending.fetch_add(1, std::memory_order_acq_rel)) {
+          const t_eventfd::t_value value = 1;
+          return eventfd_.write(value);
+        }
+        return t_errn{0};
+      }
+      return t_errn{-1};
+    }
+
+  private:
+    t_validity valid_   = INVALID;
+    int        memfd_   = -1;
+    t_eventfd  eventfd_;
+    p_void     base_    = nullptr;
+    t_uint64   size_    = 0;
+    t_map_     map_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  t_client::t_client(t_err err, t_fd socket, t_user user) noexcept
+    : user_{user} {
+    ERR_GUARD(err) {
+      impl_ = new t_client_impl_(err, socket);
+      if (impl_ == VALID) {
+        if (err)
+          impl_.clear();
+      } else
+        err = err::E_XXX;
+    }
+  }
+
+  t_client::t_client(x_client client) noexcept
+    : impl_{client.impl_.release()},
+      user_{named::utility::reset(client.user_)} {
+  }
+
+  t_client::~t_client() {
+    impl_.clear();
+  }
+
+  t_client::operator t_validity() const noexcept {
+    return impl_ == VALID && *impl_ == VALID ? VALID : INVALID;
+  }
+
+  t_slot t_client::acquire() noexcept {
+    if (*this == VALID)
+      return impl_->acquire();
+    return {};
+  }
+
+  t_slot t_client::acquire(t_err err) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID) {
+        t_slot slot = impl_->acquire();
+        if (slot == VALID)
+          return slot;
+      }
+      err = err::E_XXX;
+    }
+    return {};
+  }
+
+  t_errn t_client::insert(t_slot slot) noexcept {
+    if (*this == VALID)
+      return impl_->insert(slot);
+    return t_errn{-1};
+  }
+
+  t_void t_client::insert(t_err err, t_slot slot) noexcept {
+    ERR_GUARD(err) {
+      if (*this != VALID || impl_->insert(slot) != VALID)
+        err = err::E_XXX;
+    }
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+  t_processor::t_processor(t_err err, t_n max, t_n slot_size) noexcept {
+    ERR_GUARD(err) {
+      impl_ = new t_impl_(err, max, slot_size);
+      if (impl_ == VALID) {
+        if (err)
+          impl_.clear();
+      } else
+        err = err::E_XXX;
+    }
+  }
+
+  t_processor::t_processor(x_processor processor) noexcept
+    : impl_{processor.impl_.release()} {
+  }
+
+  t_processor::~t_processor() {
+    impl_.clear();
+  }
+
+  t_processor::operator t_validity() const noexcept {
+    return impl_ == VALID && *impl_ == VALID ? VALID : INVALID;
+  }
+
+  t_fd t_processor::get_fd() const noexcept {
+    if (*this == VALID)
+      return impl_->get_fd();
+    return named::BAD_FD;
+  }
+
+  t_errn t_processor::share(t_fd socket) noexcept {
+    if (*this == VALID)
+      return impl_->share(socket);
+    return t_errn{-1};
+  }
+
+  t_void t_processor::share(t_err err, t_fd socket) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->share(err, socket);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_void t_processor::process(t_err err, r_logic logic, t_n max) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->process(err, logic, max);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_void t_processor::process_available(t_err err, r_logic logic) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->process_available(err, logic);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
@@ -0,0 +1,168 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+#ifndef _DAINTY_MT_SHM_CHAINED_QUEUE_H_
+#define _DAINTY_MT_SHM_CHAINED_QUEUE_H_
+
+// description
+// shm_chained_queue is a chained_queue whose slot pool, free list and ready
+// list live in a shared memory mapping (memfd), so producer and consumer can
+// run in different processes. the processor owns the mapping and the
+// eventfd and passes both over a UNIX domain socket with share. a client in
+// the other process is made from the receiving end of that socket.
+//
+// slots are fixed size byte buffers, payloads must be trivially copyable.
+// a producer that dies between acquire and insert loses its slot; one that
+// dies inside insert stalls the ready list.
+
+#include "dainty_named_ptr.h"
+#include "dainty_named_utility.h"
+#include "dainty_mt_err.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace shm_chained_queue
+{
+  using named::t_fd;
+  using named::t_n;
+  using named::t_ix;
+  using named::p_void;
+  using named::t_void;
+  using named::t_validity;
+  using named::VALID;
+  using named::INVALID;
+  using named::t_errn;
+  using named::t_prefix;
+  using err::t_err;
+
+  enum  t_user_tag_ { };
+  using t_user = named::t_user<t_user_tag_>;
+
+  class t_slot {
+  public:
+    t_ix   ix   = t_ix{0};
+    p_void ptr  = nullptr; // mapped in the calling process
+    t_n    size = t_n{0};  // bytes usable at ptr
+
+    operator t_validity() const noexcept {
+      return ptr ? VALID : INVALID;
+    }
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_impl_;
+  enum  t_impl_owner_tag_ { };
+  using t_impl_owner_ = named::ptr::t_ptr<t_impl_, t_impl_owner_tag_,
+                                          named::ptr::t_deleter>;
+
+  class t_client_impl_;
+  enum  t_client_impl_owner_tag_ { };
+  using t_client_impl_owner_ = named::ptr::t_ptr<t_client_impl_,
+                                                 t_client_impl_owner_tag_,
+                                                 named::ptr::t_deleter>;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_client;
+  using r_client = t_prefix<t_client>::r_;
+  using x_client = t_prefix<t_client>::x_;
+  using R_client = t_prefix<t_client>::R_;
+
+  class t_client {
+  public:
+    // receive the mapping and the eventfd sent by t_processor::share.
+     t_client(t_err, t_fd socket, t_user) noexcept;
+     t_client(x_client)                   noexcept;
+    ~t_client();
+
+    t_client(R_client)           = delete;
+    r_client operator=(R_client) = delete;
+    r_client operator=(x_client) = delete;
+
+    operator t_validity() const noexcept;
+
+    t_slot acquire()      noexcept;
+    t_slot acquire(t_err) noexcept;
+
+    t_errn insert(       t_slot) noexcept;
+    t_void insert(t_err, t_slot) noexcept;
+
+  private:
+    t_client_impl_owner_ impl_;
+    t_user               user_ = t_user{0L};
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  class t_processor;
+  using r_processor = t_prefix<t_processor>::r_;
+  using x_processor = t_prefix<t_processor>::x_;
+  using R_processor = t_prefix<t_processor>::R_;
+
+  class t_processor {
+  public:
+    class t_logic {
+    public:
+      using t_slot = shm_chained_queue::t_slot;
+
+      virtual ~t_logic() { }
+      virtual t_void async_process(t_slot) noexcept = 0;
+    };
+
+    using r_logic = t_logic&;
+
+     t_processor(t_err, t_n max, t_n slot_size) noexcept;
+     t_processor(x_processor)                   noexcept;
+    ~t_processor();
+
+    t_processor(R_processor)           = delete;
+    r_processor operator=(x_processor) = delete;
+    r_processor operator=(R_processor) = delete;
+
+    operator t_validity () const noexcept;
+
+    t_fd get_fd() const noexcept;
+
+    // send the mapping and the eventfd to the peer of a UNIX socket.
+    t_errn share(       t_fd socket) noexcept;
+    t_void share(t_err, t_fd socket) noexcept;
+
+    t_void process          (t_err, r_logic, t_n max = t_n{1}) noexcept;
+    t_void process_available(t_err, r_logic) noexcept;
+
+  private:
+    t_impl_owner_ impl_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
+
+#endif
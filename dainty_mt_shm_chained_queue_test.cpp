@@ -0,0 +1,125 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// a client made from a shared processor signals it through the received
+// eventfd, and a client that receives the wrong descriptors closes them.
+
+#include <cassert>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "dainty_mt_err.h"
+#include "dainty_mt_shm_chained_queue.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::shm_chained_queue;
+
+namespace
+{
+  using named::t_n_;
+
+  struct t_logic_ : t_processor::t_logic {
+    char last = 0;
+
+    t_void async_process(t_slot slot) noexcept override {
+      last = *static_cast<char*>(slot.ptr);
+    }
+  };
+
+  t_n_ open_fds_() {
+    t_n_ n = 0;
+    DIR* dir = ::opendir("/proc/self/fd");
+    while (::readdir(dir))
+      ++n;
+    ::closedir(dir);
+    return n;
+  }
+
+  // send a single descriptor where the client expects two.
+  t_void send_one_fd_(int socket, int fd) {
+    char  byte = 0;
+    iovec iov{&byte, 1};
+    union {
+      cmsghdr hdr;
+      char    buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    std::memset(&ctrl, 0, sizeof(ctrl));
+
+    msghdr msg{};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    cmsghdr* cmsg    = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    assert(::sendmsg(socket, &msg, 0) == 1);
+  }
+}
+
+int main() {
+  int sockets[2];
+  assert(!::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+
+  {
+    err::t_err  err;
+    t_processor processor{err, t_n{4}, t_n{8}};
+    assert(!err && processor == VALID);
+    processor.share(err, t_fd{sockets[0]});
+
+    t_client client{err, t_fd{sockets[1]}, t_user{1L}};
+    assert(!err && client == VALID);
+
+    t_logic_ logic;
+    for (char value = 1; value < 8; ++value) {
+      t_slot slot = client.acquire(err);
+      assert(!err && slot == VALID);
+      *static_cast<char*>(slot.ptr) = value;
+      client.insert(err, slot);
+      processor.process(err, logic);
+      assert(!err && logic.last == value);
+    }
+  }
+
+  {
+    const t_n_ before = open_fds_();
+    send_one_fd_(sockets[0], 0);
+    err::t_err err;
+    t_client   client{err, t_fd{sockets[1]}, t_user{1L}};
+    assert(err && client == INVALID);
+    assert(open_fds_() == before);
+  }
+
+  ::close(sockets[0]);
+  ::close(sockets[1]);
+  return 0;
+}
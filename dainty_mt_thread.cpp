@@ -78,21 +78,17 @@ namespace thread
       t_logic_ptr logic{x_cast(data->logic_)};
       r_err err = data->err_;
 
+      // data lives on the stack of the creator, which returns as soon as
+      // it sees ready_. it must not be touched once the lock is released.
+      t_bool ready = false;
       t_thread_::set_name(err, t_thread_::get_self(), data->name_);
       <% auto scope = data->lock_.make_locked_scope(err);
         logic->prepare(err);
-        data->ready_ = !err;
-      %>
-
-      p_void returnarg = nullptr;
-      if (!err) {
-        data->cond_.signal(err);
-        if (!err)
-          returnarg = logic->run();
-      } else
+        ready = data->ready_ = !err;
         data->cond_.signal();
+      %>
 
-      return returnarg;
+      return ready ? logic->run() : nullptr;
     }
   }
 
@@ -112,25 +108,43 @@ namespace thread
     }
   }
 
-  t_thread::t_thread(t_err err, P_cstr name, x_logic_ptr logic) noexcept {
+  t_thread::t_thread(t_err err, P_cstr name, x_logic_ptr logic,
+                     t_join_mode mode) noexcept {
     ERR_GUARD(err) {
       t_data_ data{err, name, x_cast(logic)};
       if (get(name) && data.logic_ && data.cond_ == VALID &&
           data.lock_ == VALID) {
         t_attr_ attr;
         call_pthread_init(err, attr);
-        call_pthread_set_detach(err, attr);
+        if (mode == DETACHED)
+          call_pthread_set_detach(err, attr);
         data.logic_->update(err, attr);
         thread_.create(err, start_, &data, attr);
+        const t_bool created = !err;
         <% auto scope = data.lock_.make_locked_scope(err);
            while (!err && !data.ready_)
              data.cond_.wait(err, data.lock_);
         %>
+        // a joinable thread whose prepare failed has returned, or will.
+        if (created && mode == JOINABLE && !data.ready_) {
+          p_void arg = nullptr;
+          thread_.join(arg);
+        }
       } else
         err = err::E_XXX;
     }
   }
 
+  t_errn t_thread::join() noexcept {
+    p_void arg = nullptr;
+    return join(arg);
+  }
+
+  t_void t_thread::join(t_err err) noexcept {
+    p_void arg = nullptr;
+    join(err, arg);
+  }
+
   t_errn t_thread::join(p_void& arg) noexcept {
     return thread_.join(arg);
   }
@@ -49,6 +49,12 @@ namespace thread
   using container::ptr::t_passable_ptr;
   using err::t_err;
 
+///////////////////////////////////////////////////////////////////////////////
+
+  // DETACHED: the thread cleans up after itself. join fails.
+  // JOINABLE: the thread must be joined exactly once, or it leaks.
+  enum t_join_mode { DETACHED, JOINABLE };
+
 ///////////////////////////////////////////////////////////////////////////////
 
   class t_thread;
@@ -72,7 +78,8 @@ namespace thread
     using t_logic_ptr = t_passable_ptr<t_logic>;
     using x_logic_ptr = t_prefix<t_logic_ptr>::x_;
 
-    t_thread(t_err, P_cstr name, x_logic_ptr) noexcept;
+    t_thread(t_err, P_cstr name, x_logic_ptr,
+             t_join_mode = DETACHED) noexcept;
 
     t_thread(R_thread)           = delete;
     t_thread(x_thread)           = delete;
@@ -0,0 +1,106 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// a t_thread is detached unless it is asked to be joinable, and a detached
+// one goes away by itself. a joinable one runs its logic and is joined,
+// and one whose prepare fails is joined by the constructor.
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cassert>
+#include <dirent.h>
+#include "dainty_mt_thread.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::thread;
+
+namespace
+{
+  using named::t_n_;
+
+  struct t_logic_ : t_thread::t_logic {
+    std::atomic<t_bool>& ran;
+    t_bool               fail;
+
+    t_logic_(std::atomic<t_bool>& _ran, t_bool _fail)
+      : ran(_ran), fail(_fail) {
+    }
+
+    t_void prepare(t_err err) noexcept override {
+      if (fail)
+        err = err::E_XXX;
+    }
+
+    p_void run() noexcept override {
+      ran = true;
+      return nullptr;
+    }
+  };
+
+  t_n_ threads_() {
+    t_n_ n = 0;
+    DIR* dir = ::opendir("/proc/self/task");
+    while (::readdir(dir))
+      ++n;
+    ::closedir(dir);
+    return n - 2; // . and ..
+  }
+}
+
+int main() {
+  {
+    std::atomic<t_bool> ran{false};
+    err::t_err err;
+    t_thread   thread{err, P_cstr("joinable"),
+                      t_thread::t_logic_ptr{new t_logic_{ran, false}},
+                      JOINABLE};
+    assert(!err);
+    thread.join(err);
+    assert(!err && ran && threads_() == 1);
+  }
+  {
+    std::atomic<t_bool> ran{false};
+    err::t_err err;
+    t_thread   thread{err, P_cstr("failing"),
+                      t_thread::t_logic_ptr{new t_logic_{ran, true}},
+                      JOINABLE};
+    assert(err && !ran && threads_() == 1);
+    err.clear();
+  }
+  {
+    std::atomic<t_bool> ran{false};
+    err::t_err err;
+    t_thread   thread{err, P_cstr("detached"),
+                      t_thread::t_logic_ptr{new t_logic_{ran, false}}};
+    assert(!err);
+    while (!ran || threads_() != 1) // gone without a join
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return 0;
+}
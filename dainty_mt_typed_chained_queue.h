@@ -0,0 +1,382 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+#ifndef _DAINTY_MT_TYPED_CHAINED_QUEUE_H_
+#define _DAINTY_MT_TYPED_CHAINED_QUEUE_H_
+
+// description
+// t_typed_processor<T, N> is a chained_queue without type erasure. N values
+// of T are stored inline in a preallocated ring that doubles as slot pool.
+// values are moved in by t_typed_client<T> and moved out to t_logic. there
+// is no allocation per message and the eventfd (get_fd) is signalled the
+// same way as a LOCKFREE_MODE t_processor.
+
+#include <new>
+#include <atomic>
+#include <utility>
+#include "dainty_named_ptr.h"
+#include "dainty_named_utility.h"
+#include "dainty_os_fdbased.h"
+#include "dainty_mt_chained_queue.h"
+
+namespace dainty
+{
+namespace mt
+{
+namespace chained_queue
+{
+  using named::t_n_;
+  using named::t_bool;
+  using named::t_uint64;
+  using named::t_int64;
+
+///////////////////////////////////////////////////////////////////////////////
+
+  // part shared between a t_typed_processor and its clients.
+  template<typename T>
+  class t_typed_queue_ {
+  public:
+    using t_value   = T;
+    using t_eventfd = os::fdbased::t_eventfd;
+
+    struct t_cell_ {
+      std::atomic<t_uint64> seq{0};
+      alignas(T) unsigned char store[sizeof(T)];
+
+      T& ref() noexcept { return *reinterpret_cast<T*>(store); }
+    };
+    using p_cell_ = t_cell_*;
+
+    t_typed_queue_(t_err err, p_cell_ cells, t_n_ n) noexcept
+      : eventfd_{err, t_n{0}}, cells_{cells}, mask_{n - 1} {
+      for (t_uint64 ix = 0; ix < n; ++ix)
+        cells_[ix].seq.store(ix, std::memory_order_relaxed);
+    }
+
+    operator t_validity() const noexcept {
+      return eventfd_ == VALID ? VALID : INVALID;
+    }
+
+    t_fd get_fd() const noexcept {
+      return eventfd_.get_fd();
+    }
+
+    template<typename... Args>
+    t_errn insert(Args&&... args) noexcept {
+      t_uint64 pos  = 0;
+      p_cell_  cell = claim_push_(pos);
+      if (cell) {
+        new (cell->store) T(std::forward<Args>(args)...);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        if (!pending_.fetch_add(1, std::memory_order_acq_rel)) {
+          t_eventfd::t_value value = 1;
+          return eventfd_.write(value);
+        }
+        return t_errn{0};
+      }
+      return t_errn{-1};
+    }
+
+    template<typename L>
+    t_void process(t_err err, L& logic, t_n max) noexcept {
+      for (t_n_ n = get(max); !err && n; --n) {
+        t_uint64 pos  = 0;
+        p_cell_  cell = nullptr;
+        while (!err && !(cell = claim_pop_(pos))) {
+          // a producer that claimed a cell but did not publish it yet,
+          // holds up the ring for a moment. only block when nothing is due.
+          if (pending_.load(std::memory_order_acquire) <= 0)
+            read_(err);
+        }
+        if (cell)
+          deliver_(err, logic, cell, pos);
+      }
+    }
+
+    template<typename L>
+    t_void process_available(t_err err, L& logic) noexcept {
+      t_uint64 pos  = 0;
+      p_cell_  cell = claim_pop_(pos);
+      if (cell)
+        deliver_(err, logic, cell, pos);
+    }
+
+  protected:
+    // destroy values that were never processed. called by the owner of the
+    // cells while they are still alive.
+    t_void clear_() noexcept {
+      t_uint64 pos = 0;
+      for (p_cell_ cell = claim_pop_(pos); cell; cell = claim_pop_(pos))
+        release_(cell, pos);
+    }
+
+  private:
+    p_cell_ claim_push_(t_uint64& pos) noexcept {
+      pos = tail_.load(std::memory_order_relaxed);
+      for (;;) {
+        p_cell_  cell = &cells_[pos & mask_];
+        t_int64  diff = static_cast<t_int64>(
+                          cell->seq.load(std::memory_order_acquire) - pos);
+        if (!diff) {
+          if (tail_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed))
+            return cell;
+        } else if (diff < 0)
+          return nullptr;
+        else
+          pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    // single consumer: no other thread moves head_.
+    p_cell_ claim_pop_(t_uint64& pos) noexcept {
+      pos = head_.load(std::memory_order_relaxed);
+      p_cell_ cell = &cells_[pos & mask_];
+      if (cell->seq.load(std::memory_order_acquire) == pos + 1) {
+        head_.store(pos + 1, std::memory_order_relaxed);
+        return cell;
+      }
+      return nullptr;
+    }
+
+    t_void release_(p_cell_ cell, t_uint64 pos) noexcept {
+      cell->ref().~T();
+      cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    }
+
+    t_void read_(t_err err) noexcept {
+      t_eventfd::t_value value = 0;
+      eventfd_.read(err, value);
+      if (!err)
+        consumed_ += value;
+    }
+
+    template<typename L>
+    t_void deliver_(t_err err, L& logic, p_cell_ cell, t_uint64 pos) noexcept {
+      if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+          ++owed_ > consumed_)
+        read_(err);
+      logic.async_process(std::move(cell->ref()));
+      release_(cell, pos);
+    }
+
+    t_eventfd             eventfd_;
+    const p_cell_         cells_;
+    const t_uint64        mask_;
+    std::atomic<t_uint64> head_{0};
+    std::atomic<t_uint64> tail_{0};
+    std::atomic<t_int64>  pending_{0};
+    t_uint64              owed_     = 0;
+    t_uint64              consumed_ = 0;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  template<typename T, t_n_ N> class t_typed_processor;
+
+  template<typename T>
+  class t_typed_client {
+  public:
+    using t_value  = T;
+    using r_client = typename t_prefix<t_typed_client>::r_;
+    using x_client = typename t_prefix<t_typed_client>::x_;
+    using R_client = typename t_prefix<t_typed_client>::R_;
+
+    t_typed_client(x_client client) noexcept
+      : queue_{client.queue_.release()},
+        user_{named::utility::reset(client.user_)} {
+    }
+
+    r_client operator=(R_client) = delete;
+    r_client operator=(x_client) = delete;
+
+    operator t_validity() const noexcept {
+      return queue_ == VALID && *queue_ == VALID ? VALID : INVALID;
+    }
+
+    t_errn insert(T&& value) noexcept {
+      if (*this == VALID)
+        return queue_->insert(std::move(value));
+      return t_errn{-1};
+    }
+
+    t_void insert(t_err err, T&& value) noexcept {
+      ERR_GUARD(err) {
+        if (*this != VALID || queue_->insert(std::move(value)) != VALID)
+          err = err::E_XXX;
+      }
+    }
+
+    // construct the value in its slot from args and publish it.
+    template<typename... Args>
+    t_errn emplace(Args&&... args) noexcept {
+      if (*this == VALID)
+        return queue_->insert(std::forward<Args>(args)...);
+      return t_errn{-1};
+    }
+
+    template<typename... Args>
+    t_void emplace(t_err err, Args&&... args) noexcept {
+      ERR_GUARD(err) {
+        if (*this != VALID ||
+            queue_->insert(std::forward<Args>(args)...) != VALID)
+          err = err::E_XXX;
+      }
+    }
+
+  private:
+    template<typename, t_n_> friend class t_typed_processor;
+
+    enum  t_queue_user_tag_ { };
+    using t_queue_user_ = named::ptr::t_ptr<t_typed_queue_<T>,
+                                            t_queue_user_tag_,
+                                            named::ptr::t_no_deleter>;
+
+    t_typed_client() = default;
+    t_typed_client(t_typed_queue_<T>* queue, t_user user) noexcept
+      : queue_{queue}, user_{user} {
+    }
+
+    t_queue_user_ queue_;
+    t_user        user_ = t_user{0L};
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+  template<typename T, t_n_ N>
+  class t_typed_processor {
+    static_assert(N && !(N & (N - 1)), "N must be a power of 2");
+
+  public:
+    class t_logic {
+    public:
+      using t_value = T;
+
+      virtual ~t_logic() { }
+      virtual t_void async_process(T&&) noexcept = 0;
+    };
+
+    using r_logic     = t_logic&;
+    using t_client    = t_typed_client<T>;
+    using r_processor = typename t_prefix<t_typed_processor>::r_;
+    using x_processor = typename t_prefix<t_typed_processor>::x_;
+    using R_processor = typename t_prefix<t_typed_processor>::R_;
+
+    t_typed_processor(t_err err) noexcept {
+      ERR_GUARD(err) {
+        impl_ = new (std::nothrow) t_impl_(err);
+        if (impl_ == VALID) {
+          if (err)
+            impl_.clear();
+        } else
+          err = err::E_XXX;
+      }
+    }
+
+    t_typed_processor(x_processor processor) noexcept
+      : impl_{processor.impl_.release()} {
+    }
+
+    ~t_typed_processor() {
+      impl_.clear();
+    }
+
+    t_typed_processor(R_processor)     = delete;
+    r_processor operator=(x_processor) = delete;
+    r_processor operator=(R_processor) = delete;
+
+    operator t_validity() const noexcept {
+      return impl_ == VALID && *impl_ == VALID ? VALID : INVALID;
+    }
+
+    t_fd get_fd() const noexcept {
+      if (*this == VALID)
+        return impl_->get_fd();
+      return named::BAD_FD;
+    }
+
+    t_void process(t_err err, r_logic logic, t_n max = t_n{1}) noexcept {
+      ERR_GUARD(err) {
+        if (*this == VALID)
+          impl_->process(err, logic, max);
+        else
+          err = err::E_XXX;
+      }
+    }
+
+    t_void process_available(t_err err, r_logic logic) noexcept {
+      ERR_GUARD(err) {
+        if (*this == VALID)
+          impl_->process_available(err, logic);
+        else
+          err = err::E_XXX;
+      }
+    }
+
+    t_client make_client(t_user user) noexcept {
+      if (*this == VALID)
+        return {&*impl_, user};
+      return {};
+    }
+
+    t_client make_client(t_err err, t_user user) noexcept {
+      ERR_GUARD(err) {
+        if (*this == VALID)
+          return {&*impl_, user};
+        err = err::E_XXX;
+      }
+      return {};
+    }
+
+  private:
+    using t_queue_ = t_typed_queue_<T>;
+    using t_cell_  = typename t_queue_::t_cell_;
+
+    // the cells live in a base listed before t_queue_, so they are
+    // constructed first and t_queue_ seeds their sequence numbers last.
+    struct t_cells_ {
+      t_cell_ cells_[N];
+    };
+
+    struct t_impl_ : t_cells_, t_queue_ {
+      t_impl_(t_err err) noexcept
+        : t_cells_{}, t_queue_{err, t_cells_::cells_, N} {
+      }
+     ~t_impl_() { this->clear_(); }
+    };
+
+    enum  t_impl_owner_tag_ { };
+    using t_impl_owner_ = named::ptr::t_ptr<t_impl_, t_impl_owner_tag_,
+                                            named::ptr::t_deleter>;
+    t_impl_owner_ impl_;
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+}
+}
+}
+
+#endif
@@ -0,0 +1,78 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// push and pop through a t_typed_processor more times than it has cells, so
+// every cell is reused and its sequence number must have been seeded.
+
+#include <cassert>
+#include "dainty_mt_err.h"
+#include "dainty_mt_typed_chained_queue.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+
+namespace
+{
+  using named::t_int;
+  using named::t_n;
+  using named::VALID;
+
+  struct t_logic_ : chained_queue::t_typed_processor<t_int, 4>::t_logic {
+    t_int next = 0;
+
+    named::t_void async_process(t_int&& value) noexcept override {
+      assert(value == next);
+      ++next;
+    }
+  };
+}
+
+int main() {
+  err::t_err err;
+  chained_queue::t_typed_processor<t_int, 4> processor{err};
+  assert(!err && processor == VALID);
+
+  auto client = processor.make_client(err, chained_queue::t_user{1L});
+  assert(!err && client == VALID);
+
+  t_logic_ logic;
+  for (t_int value = 0; value < 4 * 8; ++value) {
+    assert(client.insert(t_int{value}) == VALID);
+    processor.process(err, logic, t_n{1});
+    assert(!err);
+  }
+  assert(logic.next == 4 * 8);
+
+  // fill the ring, confirm it is full, then drain it in one go.
+  for (t_int value = 0; value < 4; ++value)
+    assert(client.emplace(logic.next + value) == VALID);
+  assert(client.insert(t_int{-1}) != VALID);
+  processor.process(err, logic, t_n{4});
+  assert(!err && logic.next == 4 * 9);
+
+  return 0;
+}
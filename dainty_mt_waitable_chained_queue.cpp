@@ -24,9 +24,12 @@
 
 ******************************************************************************/
 
+#include <new>
+#include <utility>
 #include "dainty_os_fdbased.h"
 #include "dainty_os_threading.h"
 #include "dainty_mt_waitable_chained_queue.h"
+#include "dainty_mt_internal_.h"
 
 namespace dainty
 {
@@ -36,24 +39,124 @@ namespace waitable_chained_queue
 {
   using err::r_err;
   using named::t_n_;
+  using named::t_uint64;
   using dainty::os::t_errn;
   using namespace dainty::os::threading;
   using namespace dainty::os::fdbased;
 
+  using internal_::t_pad_;
   using t_queue = container::chained_queue::t_chained_queue<t_entry>;
 
+///////////////////////////////////////////////////////////////////////////////
+
+  namespace
+  {
+    // fixed size open addressing map from key to queued item. it holds at
+    // most max keys in 2*max cells, so it never fills up or rehashes.
+    template<typename P>
+    class t_index_ {
+    public:
+      t_index_(t_n max) noexcept
+        : mask_{cells_for_(get(max)) - 1},
+          cells_{new (std::nothrow) t_cell_[mask_ + 1]} {
+      }
+
+      ~t_index_() {
+        delete [] cells_;
+      }
+
+      t_index_(const t_index_&)            = delete;
+      t_index_& operator=(const t_index_&) = delete;
+
+      operator t_validity() const noexcept {
+        return cells_ ? VALID : INVALID;
+      }
+
+      t_bool is_empty() const noexcept {
+        return !size_;
+      }
+
+      P find(t_key key) const noexcept {
+        for (t_uint64 ix = home_(key); cells_[ix].ptr; ix = (ix + 1) & mask_)
+          if (cells_[ix].key == key)
+            return cells_[ix].ptr;
+        return nullptr;
+      }
+
+      t_bool insert(t_key key, P ptr) noexcept {
+        if (size_ > mask_/2)
+          return false;
+        t_uint64 ix = home_(key);
+        for (; cells_[ix].ptr; ix = (ix + 1) & mask_)
+          if (cells_[ix].key == key)
+            return false;
+        cells_[ix].key = key;
+        cells_[ix].ptr = ptr;
+        ++size_;
+        return true;
+      }
+
+      t_void erase(t_key key) noexcept {
+        t_uint64 ix = home_(key);
+        for (; cells_[ix].ptr; ix = (ix + 1) & mask_) {
+          if (cells_[ix].key == key) {
+            // shift back followers so that no probe sequence is broken.
+            for (t_uint64 next = (ix + 1) & mask_; cells_[next].ptr;
+                 next = (next + 1) & mask_) {
+              const t_uint64 home = home_(cells_[next].key);
+              if (((next - home) & mask_) >= ((next - ix) & mask_)) {
+                cells_[ix] = cells_[next];
+                ix = next;
+              }
+            }
+            cells_[ix].ptr = nullptr;
+            --size_;
+            return;
+          }
+        }
+      }
+
+    private:
+      struct t_cell_ {
+        t_key key;
+        P     ptr = nullptr;
+      };
+
+      static t_uint64 cells_for_(t_uint64 max) noexcept {
+        t_uint64 size = 2;
+        while (size < 2*max)
+          size <<= 1;
+        return size;
+      }
+
+      t_uint64 home_(t_key key) const noexcept {
+        t_uint64 h = get(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h & mask_;
+      }
+
+      const t_uint64 mask_;
+      t_cell_*       cells_;
+      t_uint64       size_ = 0;
+    };
+  }
+
 ///////////////////////////////////////////////////////////////////////////////
 
   class t_impl_ {
   public:
-    using t_chain = t_queue::t_chain;
-    using r_logic = t_processor::r_logic;
+    using t_chain   = t_queue::t_chain;
+    using r_logic   = t_processor::r_logic;
+    using p_item_   = t_queue::p_item;
+    using p_merger_ = t_merger*;
 
     t_impl_(r_err err, t_n max) noexcept
-      : queue_{err, max}, eventfd_(err, t_n{0}), lock1_{err}, lock2_{err},
-        cond_{err} {
+      : queue_{err, max}, eventfd_(err, t_n{0}), lock1_{err},
+        max_{get(max)}, free_{get(max)}, lock2_{err}, index_{max} {
       if (queue_ == VALID && eventfd_ == VALID && lock1_ == VALID &&
-          lock2_ == VALID && cond_    == VALID)
+          lock2_ == VALID && index_  == VALID)
         valid_ = VALID;
     }
 
@@ -69,15 +172,12 @@ namespace waitable_chained_queue
         t_chain chain;
         <% auto scope = lock2_.make_locked_scope(err);
           chain = queue_.remove(err);
+          unindex_(chain);
         %>
 
         if (get(chain.cnt)) {
           logic.async_process(chain);
-          <% auto scope = lock1_.make_locked_scope(err);
-            queue_.release(err, chain);
-            if (waiting_)
-              cond_.broadcast(err);
-          %>
+          release_(err, chain);
         }
       }
     }
@@ -86,6 +186,7 @@ namespace waitable_chained_queue
       t_chain chain;
       <% auto scope = lock2_.make_locked_scope(err);
         chain = queue_.remove(err);
+        unindex_(chain);
         if (get(chain.cnt)) {
           t_eventfd::t_value value = 0;
           eventfd_.read(err, value);
@@ -94,60 +195,58 @@ namespace waitable_chained_queue
 
       if (get(chain.cnt)) {
         logic.async_process(chain);
-        <% auto scope = lock1_.make_locked_scope(err);
-          queue_.release(err, chain);
-          if (waiting_)
-            cond_.broadcast(err);
-        %>
+        release_(err, chain);
       }
     }
 
     t_chain waitable_acquire(t_user) noexcept {
       <% auto scope = lock1_.make_locked_scope();
-        if (scope == VALID) {
-          t_chain chain;
-          ++waiting_;
-          t_errn errn{-1};
-          do {
-            chain = queue_.acquire(t_n{1});
-            if (!get(chain.cnt))
-              errn = cond_.wait(lock1_);
-          } while (!get(chain.cnt) && errn == VALID);
-          --waiting_;
-          return chain;
-        }
+        if (scope == VALID)
+          return wait_acquire_(1, nullptr);
       %>
       return {};
     }
 
     t_chain waitable_acquire(t_err& err, t_user) noexcept {
       <% auto scope = lock1_.make_locked_scope(err);
-        if (scope == VALID) {
-          t_chain chain;
-          ++waiting_;
-          do {
-            chain = queue_.acquire(err, t_n{1});
-            if (!get(chain.cnt))
-              cond_.wait(err, lock1_);
-          } while (!get(chain.cnt) && !err);
-          --waiting_;
-          return chain;
-        }
+        if (scope == VALID)
+          return wait_acquire_(err, 1, nullptr);
       %>
       return {};
     }
 
-    t_chain acquire(t_user, t_n n) noexcept {
+    t_chain waitable_acquire(t_user, t_n n, t_time deadline) noexcept {
       <% auto scope = lock1_.make_locked_scope();
         if (scope == VALID)
-          return queue_.acquire(n);
+          return wait_acquire_(get(n), &deadline);
+      %>
+      return {};
+    }
+
+    t_chain waitable_acquire(t_err& err, t_user, t_n n,
+                             t_time deadline) noexcept {
+      <% auto scope = lock1_.make_locked_scope(err);
+        if (scope == VALID)
+          return wait_acquire_(err, get(n), &deadline);
+      %>
+      return {};
+    }
+
+    t_chain acquire(t_user, t_n n) noexcept {
+      <% auto scope = lock1_.make_locked_scope();
+        if (scope == VALID && !head_)
+          return take_(get(n));
       %>
       return {};
     }
 
     t_chain acquire(t_err& err, t_user, t_n n) noexcept {
       <% auto scope = lock1_.make_locked_scope(err);
-        return queue_.acquire(err, n);
+        if (!err) {
+          if (!head_)
+            return take_(err, get(n));
+          err = err::E_XXX;
+        }
       %>
       return {};
     }
@@ -232,6 +331,55 @@ namespace waitable_chained_queue
         err = err::E_XXX;
     }
 
+    t_errn coalesced_insert(t_user, t_key key, t_chain& chain,
+                            p_merger_ merger) noexcept {
+      t_errn errn{-1};
+      if (get(chain.cnt) == 1) {
+        t_bool merged = false;
+        <% auto scope = lock2_.make_locked_scope();
+          if (scope == VALID) {
+            merged = merge_(key, chain, merger);
+            if (!merged) {
+              const t_bool send = queue_.is_empty();
+              queue_.insert(chain);
+              if (send) {
+                t_eventfd::t_value value = 1;
+                errn = eventfd_.write(value);
+              } else
+                set(errn) = 0;
+            } else
+              set(errn) = 0;
+          }
+        %>
+        if (merged)
+          errn = release_(chain);
+      }
+      return errn;
+    }
+
+    t_void coalesced_insert(r_err err, t_user, t_key key, t_chain& chain,
+                            p_merger_ merger) noexcept {
+      if (get(chain.cnt) == 1) {
+        t_bool merged = false;
+        <% auto scope = lock2_.make_locked_scope(err);
+          if (!err) {
+            merged = merge_(key, chain, merger);
+            if (!merged) {
+              const t_bool send = queue_.is_empty();
+              queue_.insert(err, chain);
+              if (send) {
+                t_eventfd::t_value value = 1;
+                eventfd_.write(err, value);
+              }
+            }
+          }
+        %>
+        if (merged)
+          release_(err, chain);
+      } else
+        err = err::E_XXX;
+    }
+
     t_fd get_fd() const noexcept {
       return eventfd_.get_fd();
     }
@@ -247,13 +395,206 @@ namespace waitable_chained_queue
     }
 
   private:
-    t_validity   valid_ = INVALID;
-    t_queue      queue_;
-    t_eventfd    eventfd_;
-    t_mutex_lock lock1_;
-    t_mutex_lock lock2_;
-    t_cond_var   cond_;
-    t_n_         waiting_ = 0;
+    // producers that wait for free slots queue up FIFO, each on its own
+    // condvar. only the head is signalled, and only once enough slots are
+    // free for it, so a release never wakes a herd. plain acquire does not
+    // overtake waiting producers.
+    struct t_waiter_ {
+      t_waiter_(t_n_ _n) noexcept : n{_n} { }
+      t_waiter_(r_err err, t_n_ _n) noexcept : cond{err}, n{_n} { }
+
+      t_monotonic_cond_var cond;
+      t_n_                 n;
+      t_waiter_*           prev = nullptr;
+      t_waiter_*           next = nullptr;
+    };
+    using p_waiter_ = t_waiter_*;
+    using r_waiter_ = t_waiter_&;
+    using P_time_   = const t_time*;
+
+    // lock2_ is held by the caller. returns true if chain was folded into
+    // the entry queued under key, otherwise indexes chain under key.
+    t_bool merge_(t_key key, t_chain& chain, p_merger_ merger) noexcept {
+      p_item_ item = index_.find(key);
+      if (item) {
+        auto& pending  = item->ref();
+        auto& incoming = chain.head->ref();
+        if (merger)
+          merger->merge(pending.any, incoming.any);
+        else
+          pending.any = std::move(incoming.any);
+        ++set(pending.cnt);
+        return true;
+      }
+      index_.insert(key, chain.head);
+      chain.head->ref().key   = key;
+      chain.head->ref().keyed = true;
+      return false;
+    }
+
+    // lock2_ is held by the caller. removed entries can no longer coalesce.
+    t_void unindex_(t_chain& chain) noexcept {
+      if (!index_.is_empty()) {
+        p_item_ item = chain.head;
+        for (t_n_ n = get(chain.cnt); n; --n, item = item->next()) {
+          auto& entry = item->ref();
+          if (entry.keyed) {
+            index_.erase(entry.key);
+            entry.keyed = false;
+          }
+        }
+      }
+    }
+
+    t_bool is_ready_(r_waiter_ waiter) const noexcept {
+      return head_ == &waiter && free_ >= waiter.n;
+    }
+
+    t_void enqueue_(r_waiter_ waiter) noexcept {
+      waiter.prev = tail_;
+      if (tail_)
+        tail_->next = &waiter;
+      else
+        head_ = &waiter;
+      tail_ = &waiter;
+    }
+
+    t_void dequeue_(r_waiter_ waiter) noexcept {
+      if (waiter.prev)
+        waiter.prev->next = waiter.next;
+      else
+        head_ = waiter.next;
+      if (waiter.next)
+        waiter.next->prev = waiter.prev;
+      else
+        tail_ = waiter.prev;
+    }
+
+    t_errn wake_() noexcept {
+      if (head_ && free_ >= head_->n)
+        return head_->cond.signal();
+      return t_errn{0};
+    }
+
+    t_chain take_(t_n_ n) noexcept {
+      t_chain chain = queue_.acquire(t_n{n});
+      free_ -= get(chain.cnt);
+      return chain;
+    }
+
+    t_chain take_(r_err err, t_n_ n) noexcept {
+      t_chain chain = queue_.acquire(err, t_n{n});
+      free_ -= get(chain.cnt);
+      return chain;
+    }
+
+    t_errn release_(t_chain& chain) noexcept {
+      <% auto scope = lock1_.make_locked_scope();
+        if (scope == VALID) {
+          free_ += get(chain.cnt);
+          queue_.release(chain);
+          return wake_();
+        }
+      %>
+      return t_errn{-1};
+    }
+
+    t_void release_(r_err err, t_chain& chain) noexcept {
+      <% auto scope = lock1_.make_locked_scope(err);
+        const t_n_ cnt = get(chain.cnt);
+        queue_.release(err, chain);
+        if (!err) {
+          free_ += cnt;
+          if (wake_() != VALID)
+            err = err::E_XXX;
+        }
+      %>
+    }
+
+    // lock1_ is held by the caller.
+    t_chain wait_acquire_(t_n_ n, P_time_ deadline) noexcept {
+      if (!n || n > max_)
+        return {};
+      if (!head_ && free_ >= n)
+        return take_(n);
+
+      t_waiter_ waiter{n};
+      if (waiter.cond != VALID)
+        return {};
+
+      enqueue_(waiter);
+      t_errn errn{0};
+      while (!is_ready_(waiter) && errn == VALID) {
+        if (deadline) {
+          const t_time now = os::clock::monotonic_now();
+          if (now < *deadline)
+            errn = waiter.cond.wait_for(lock1_, *deadline - now);
+          else
+            set(errn) = -1;
+        } else
+          errn = waiter.cond.wait(lock1_);
+      }
+
+      t_chain chain;
+      if (is_ready_(waiter))
+        chain = take_(n);
+      dequeue_(waiter);
+      wake_(); // the next in line may fit in what is left
+      return chain;
+    }
+
+    // lock1_ is held by the caller.
+    t_chain wait_acquire_(r_err err, t_n_ n, P_time_ deadline) noexcept {
+      if (!n || n > max_) {
+        err = err::E_XXX;
+        return {};
+      }
+      if (!head_ && free_ >= n)
+        return take_(err, n);
+
+      t_waiter_ waiter{err, n};
+      if (err)
+        return {};
+
+      enqueue_(waiter);
+      while (!is_ready_(waiter) && !err) {
+        if (deadline) {
+          const t_time now = os::clock::monotonic_now();
+          if (now < *deadline)
+            waiter.cond.wait_for(err, lock1_, *deadline - now);
+          else
+            err = err::E_TIMEOUT;
+        } else
+          waiter.cond.wait(err, lock1_);
+      }
+
+      t_chain chain;
+      if (!err)
+        chain = take_(err, n);
+      else if (err.id() == os::err::E_TIMEOUT) {
+        err.clear();
+        err = err::E_TIMEOUT;
+      }
+      dequeue_(waiter);
+      wake_(); // the next in line may fit in what is left
+      return chain;
+    }
+
+    t_validity        valid_ = INVALID;
+    t_queue           queue_;
+    t_eventfd         eventfd_;
+    t_pad_            pad1_;
+    // free list side: producers acquire, the consumer releases.
+    t_mutex_lock      lock1_;
+    t_n_              max_;
+    t_n_              free_;
+    p_waiter_         head_ = nullptr;
+    p_waiter_         tail_ = nullptr;
+    t_pad_            pad2_;
+    // ready list side: producers insert, the consumer removes.
+    t_mutex_lock      lock2_;
+    t_index_<p_item_> index_;
+    t_pad_            pad3_;
   };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -286,6 +627,23 @@ namespace waitable_chained_queue
     return {};
   }
 
+  t_client::t_chain t_client::waitable_acquire(t_n n,
+                                               t_time deadline) noexcept {
+    if (*this == VALID)
+      return impl_->waitable_acquire(user_, n, deadline);
+    return {};
+  }
+
+  t_client::t_chain t_client::waitable_acquire(t_err err, t_n n,
+                                               t_time deadline) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        return impl_->waitable_acquire(err, user_, n, deadline);
+      err = err::E_XXX;
+    }
+    return {};
+  }
+
   t_client::t_chain t_client::acquire(t_n cnt) noexcept {
     if (*this == VALID)
       return impl_->acquire(user_, cnt);
@@ -331,6 +689,39 @@ namespace waitable_chained_queue
     }
   }
 
+  t_errn t_client::coalesced_insert(t_key key, t_chain chain) noexcept {
+    if (*this == VALID)
+      return impl_->coalesced_insert(user_, key, chain, nullptr);
+    return t_errn{-1};
+  }
+
+  t_void t_client::coalesced_insert(t_err err, t_key key,
+                                    t_chain chain) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->coalesced_insert(err, user_, key, chain, nullptr);
+      else
+        err = err::E_XXX;
+    }
+  }
+
+  t_errn t_client::coalesced_insert(t_key key, t_chain chain,
+                                    r_merger merger) noexcept {
+    if (*this == VALID)
+      return impl_->coalesced_insert(user_, key, chain, &merger);
+    return t_errn{-1};
+  }
+
+  t_void t_client::coalesced_insert(t_err err, t_key key, t_chain chain,
+                                    r_merger merger) noexcept {
+    ERR_GUARD(err) {
+      if (*this == VALID)
+        impl_->coalesced_insert(err, user_, key, chain, &merger);
+      else
+        err = err::E_XXX;
+    }
+  }
+
 ///////////////////////////////////////////////////////////////////////////////
 
   t_processor::t_processor(t_err err, t_n max) noexcept {
@@ -27,10 +27,12 @@
 #ifndef _DAINTY_MT_WAITABLE_CHAINED_QUEUE_H_
 #define _DAINTY_MT_WAITABLE_CHAINED_QUEUE_H_
 
+#include <utility>
 #include "dainty_named_ptr.h"
 #include "dainty_named_utility.h"
 #include "dainty_container_any.h"
 #include "dainty_container_chained_queue.h"
+#include "dainty_os_clock.h"
 #include "dainty_mt_err.h"
 
 namespace dainty
@@ -42,21 +44,30 @@ namespace waitable_chained_queue
   using named::t_fd;
   using named::t_n;
   using named::t_void;
+  using named::t_bool;
   using named::t_validity;
   using named::t_errn;
   using named::t_prefix;
   using named::VALID;
   using named::INVALID;
   using err::t_err;
+  using os::clock::t_time;
 
   enum  t_user_tag_ { };
   using t_user = named::t_user<t_user_tag_>;
 
   using t_any = container::any::t_any;
+  using r_any = named::t_prefix<t_any>::r_;
+
+  enum  t_key_tag_ { };
+  using t_key_ = named::t_uint64;
+  using t_key  = named::t_explicit<t_key_, t_key_tag_>;
 
   struct t_entry {
-    t_n   cnt = t_n{1};
-    t_any any;
+    t_n    cnt   = t_n{1};
+    t_any  any;
+    t_key  key   = t_key{0}; // set by coalesced_insert
+    t_bool keyed = false;
   };
   using t_chain = container::chained_queue::t_chain<t_entry>;
 
@@ -70,6 +81,17 @@ namespace waitable_chained_queue
   using t_impl_owner_ = named::ptr::t_ptr<t_impl_, t_impl_owner_tag_,
                                           named::ptr::t_deleter>;
 
+///////////////////////////////////////////////////////////////////////////////
+
+  // merges an incoming payload into the one still queued under the same
+  // key. called with the ready list locked, keep it short.
+  class t_merger {
+  public:
+    virtual ~t_merger() { }
+    virtual t_void merge(r_any pending, r_any incoming) noexcept = 0;
+  };
+  using r_merger = named::t_prefix<t_merger>::r_;
+
 ///////////////////////////////////////////////////////////////////////////////
 
   class t_client;
@@ -91,6 +113,13 @@ namespace waitable_chained_queue
     t_chain    waitable_acquire() noexcept;
     t_chain    waitable_acquire(t_err) noexcept;
 
+    // wait until n slots are free or the monotonic deadline passes. the n
+    // slots are taken in one go. on timeout an empty chain is returned,
+    // with err set to E_TIMEOUT. waiting producers are served FIFO; acquire
+    // fails while any producer waits.
+    t_chain    waitable_acquire(       t_n n, t_time deadline) noexcept;
+    t_chain    waitable_acquire(t_err, t_n n, t_time deadline) noexcept;
+
     t_chain    acquire(       t_n = t_n{1}) noexcept;
     t_chain    acquire(t_err, t_n = t_n{1}) noexcept;
 
@@ -100,6 +129,25 @@ namespace waitable_chained_queue
     t_errn compared_insert (       t_chain) noexcept;
     t_void compared_insert (t_err, t_chain) noexcept;
 
+    // acquire a slot, construct a T from args directly in its t_any with
+    // t_any::emplace<T> and insert it. waitable_emplace waits for the slot.
+    template<typename T, typename... Args>
+    t_errn emplace         (       Args&&...) noexcept;
+    template<typename T, typename... Args>
+    t_void emplace         (t_err, Args&&...) noexcept;
+    template<typename T, typename... Args>
+    t_errn waitable_emplace(       Args&&...) noexcept;
+    template<typename T, typename... Args>
+    t_void waitable_emplace(t_err, Args&&...) noexcept;
+
+    // insert a single slot chain under key. if an entry with the same key
+    // is still queued, wherever it sits, the payload replaces it (or is
+    // merged into it), its cnt is bumped and the slot is freed again.
+    t_errn coalesced_insert(       t_key, t_chain)           noexcept;
+    t_void coalesced_insert(t_err, t_key, t_chain)           noexcept;
+    t_errn coalesced_insert(       t_key, t_chain, r_merger) noexcept;
+    t_void coalesced_insert(t_err, t_key, t_chain, r_merger) noexcept;
+
   private:
     friend class t_processor;
     friend class t_impl_;
@@ -117,6 +165,10 @@ namespace waitable_chained_queue
   using x_processor = t_prefix<t_processor>::x_;
   using R_processor = t_prefix<t_processor>::R_;
 
+  // the free list side and the ready list side sit on cache lines of their
+  // own. the slots belong to the container and stay packed, so there is no
+  // t_layout here. a chained_queue LOCKFREE_MODE processor with
+  // PADDED_LAYOUT gives every slot its own cache line.
   class t_processor {
   public:
     class t_logic {
@@ -151,6 +203,56 @@ namespace waitable_chained_queue
     t_impl_owner_ impl_;
   };
 
+///////////////////////////////////////////////////////////////////////////////
+
+  template<typename T, typename... Args>
+  inline
+  t_errn t_client::emplace(Args&&... args) noexcept {
+    t_chain chain = acquire();
+    if (get(chain.cnt)) {
+      chain.head->ref().any.template emplace<T>(std::forward<Args>(args)...);
+      return insert(chain);
+    }
+    return t_errn{-1};
+  }
+
+  template<typename T, typename... Args>
+  inline
+  t_void t_client::emplace(t_err err, Args&&... args) noexcept {
+    ERR_GUARD(err) {
+      t_chain chain = acquire(err);
+      if (!err) {
+        chain.head->ref().any.template emplace<T>(
+          std::forward<Args>(args)...);
+        insert(err, chain);
+      }
+    }
+  }
+
+  template<typename T, typename... Args>
+  inline
+  t_errn t_client::waitable_emplace(Args&&... args) noexcept {
+    t_chain chain = waitable_acquire();
+    if (get(chain.cnt)) {
+      chain.head->ref().any.template emplace<T>(std::forward<Args>(args)...);
+      return insert(chain);
+    }
+    return t_errn{-1};
+  }
+
+  template<typename T, typename... Args>
+  inline
+  t_void t_client::waitable_emplace(t_err err, Args&&... args) noexcept {
+    ERR_GUARD(err) {
+      t_chain chain = waitable_acquire(err);
+      if (!err) {
+        chain.head->ref().any.template emplace<T>(
+          std::forward<Args>(args)...);
+        insert(err, chain);
+      }
+    }
+  }
+
 ///////////////////////////////////////////////////////////////////////////////
 }
 }
@@ -0,0 +1,242 @@
+/******************************************************************************
+
+ MIT License
+
+ Copyright (c) 2018 kieme, frits.germs@gmx.net
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+******************************************************************************/
+
+// test
+// emplace and waitable_emplace build their payload in the slot, without
+// copying or moving it. a deadline bound waitable_acquire takes its n slots
+// in one go once they are released in time, and times out with E_TIMEOUT
+// otherwise. waiting producers are served in the order they came, a later
+// one that needs fewer slots does not overtake, nor does plain acquire.
+// coalesced_insert folds a payload into the one queued under its key, by
+// replacing or by merging it, and frees the slot it came in.
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cassert>
+#include "dainty_mt_err.h"
+#include "dainty_mt_waitable_chained_queue.h"
+
+using namespace dainty;
+using namespace dainty::mt;
+using namespace dainty::mt::waitable_chained_queue;
+
+namespace
+{
+  using named::t_n_;
+
+  struct t_logic_ : t_processor::t_logic {
+    t_n_ chains = 0;
+
+    t_void async_process(t_chain) noexcept override {
+      ++chains;
+    }
+  };
+
+  struct t_msg_ {
+    static t_n_ built;
+    static t_n_ moved;
+
+    t_n_ a;
+
+    t_msg_(t_n_ _a) : a(_a) { ++built; }
+    t_msg_(const t_msg_& msg) : a(msg.a) { ++moved; }
+    t_msg_(t_msg_&& msg)      : a(msg.a) { ++moved; }
+  };
+  t_n_ t_msg_::built = 0;
+  t_n_ t_msg_::moved = 0;
+
+  // the cnt and t_n_ payload of every entry handed to it.
+  struct t_entries_ : t_processor::t_logic {
+    std::vector<t_n_> cnts;
+    std::vector<t_n_> values;
+
+    t_void async_process(t_chain chain) noexcept override {
+      auto item = chain.head;
+      for (t_n_ n = get(chain.cnt); n; --n, item = item->next()) {
+        cnts.push_back(get(item->ref().cnt));
+        values.push_back(item->ref().any.ref<t_n_>());
+      }
+    }
+  };
+
+  struct t_sum_ : t_merger {
+    t_void merge(r_any pending, r_any incoming) noexcept override {
+      pending.ref<t_n_>() += incoming.ref<t_n_>();
+    }
+  };
+
+  t_void insert_(r_client client, t_key key, t_n_ value,
+                 t_merger* merger = nullptr) {
+    err::t_err err;
+    auto chain = client.acquire(err);
+    assert(!err);
+    chain.head->ref().any.emplace<t_n_>(value);
+    if (merger)
+      client.coalesced_insert(err, key, chain, *merger);
+    else
+      client.coalesced_insert(err, key, chain);
+    assert(!err);
+  }
+
+  t_time after_(named::t_int64 msecs) {
+    return os::clock::monotonic_now() + t_time{named::t_msec{msecs}};
+  }
+
+  t_void sleep_(t_n_ msecs) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(msecs));
+  }
+
+  t_void test_emplace_() {
+    err::t_err  err;
+    t_processor processor{err, t_n{2}};
+    assert(!err && processor == VALID);
+
+    auto client = processor.make_client(err, t_user{1L});
+    assert(!err && client == VALID);
+
+    t_logic_ logic;
+    for (t_n_ round = 0; round < 4; ++round) {
+      if (round % 2)
+        client.emplace<t_msg_>(err, round);
+      else
+        client.waitable_emplace<t_msg_>(err, round);
+      assert(!err);
+      processor.process(err, logic);
+      assert(!err);
+    }
+    assert(logic.chains == 4 && t_msg_::built == 4 && !t_msg_::moved);
+  }
+
+  t_void test_deadline_() {
+    err::t_err  err;
+    t_processor processor{err, t_n{2}};
+    assert(!err && processor == VALID);
+    auto client = processor.make_client(err, t_user{1L});
+    assert(!err && client == VALID);
+
+    assert(!get(client.waitable_acquire(err, t_n{3}, after_(1000)).cnt));
+    assert(err && err.id() == err::E_XXX);
+    err.clear();
+
+    auto first = client.waitable_acquire(err, t_n{1}, after_(1000));
+    assert(!err && get(first.cnt) == 1);
+
+    const auto start = os::clock::monotonic_now();
+    assert(!get(client.waitable_acquire(err, t_n{2}, after_(50)).cnt));
+    assert(err && err.id() == err::E_TIMEOUT);
+    assert(os::clock::monotonic_now() - start >= t_time{named::t_msec{50}});
+    err.clear();
+    assert(!get(client.waitable_acquire(t_n{2}, after_(10)).cnt));
+
+    // released in time, both slots are taken in one go.
+    t_logic_ logic;
+    std::thread thread{[&]() {
+      err::t_err err;
+      sleep_(20);
+      client.insert(err, first);
+      processor.process(err, logic);
+      assert(!err);
+    }};
+    auto both = client.waitable_acquire(err, t_n{2}, after_(5000));
+    thread.join();
+    assert(!err && get(both.cnt) == 2 && logic.chains == 1);
+  }
+
+  t_void test_fifo_() {
+    err::t_err  err;
+    t_processor processor{err, t_n{2}};
+    assert(!err && processor == VALID);
+    auto client = processor.make_client(err, t_user{1L});
+    assert(!err && client == VALID);
+
+    auto held = client.acquire(err);
+    client.insert(err, client.acquire(err));
+    assert(!err && get(held.cnt) == 1);
+
+    std::atomic<t_n_> served{0};
+    t_n_              order[2] = {0, 0};
+    auto waiter = [&](t_n_ ix, t_n_ n) {
+      err::t_err err;
+      auto chain = client.waitable_acquire(err, t_n{n}, after_(5000));
+      assert(!err && get(chain.cnt) == n);
+      order[ix] = ++served;
+      client.insert(err, chain);
+    };
+    std::thread first {waiter, 0, 2};
+    sleep_(20);
+    std::thread second{waiter, 1, 1};
+    sleep_(20);
+
+    // one free slot does not do for the head, and nobody may take it.
+    t_logic_ logic;
+    processor.process(err, logic);
+    sleep_(20);
+    assert(!err && !served && !get(client.acquire().cnt));
+
+    client.insert(err, held);
+    for (t_n_ n = 0; n < 3; ++n) // held, then what each waiter inserts
+      processor.process(err, logic);
+    first.join();
+    second.join();
+    assert(!err && order[0] == 1 && order[1] == 2 && logic.chains == 4);
+  }
+
+  t_void test_coalesced_() {
+    err::t_err  err;
+    t_processor processor{err, t_n{3}};
+    assert(!err && processor == VALID);
+    auto client = processor.make_client(err, t_user{1L});
+    assert(!err && client == VALID);
+
+    insert_(client, t_key{1}, 1);
+    insert_(client, t_key{2}, 10);
+    insert_(client, t_key{1}, 2);
+    insert_(client, t_key{1}, 3); // the folded slots are free again
+
+    t_entries_ logic;
+    processor.process(err, logic);
+    assert(!err && (logic.cnts   == std::vector<t_n_>{3, 1}));
+    assert((logic.values == std::vector<t_n_>{3, 10}));
+
+    // once processed, a key starts over.
+    t_sum_ sum;
+    insert_(client, t_key{1}, 5, &sum);
+    insert_(client, t_key{1}, 7, &sum);
+    processor.process(err, logic);
+    assert(!err && (logic.cnts   == std::vector<t_n_>{3, 1, 2}));
+    assert((logic.values == std::vector<t_n_>{3, 10, 12}));
+  }
+}
+
+int main() {
+  test_emplace_();
+  test_deadline_();
+  test_fifo_();
+  test_coalesced_();
+  return 0;
+}